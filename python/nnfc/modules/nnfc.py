@@ -75,6 +75,12 @@ class CompressionLayer(Module):
         return self.running_stats['sizeof_intermediates']
 
 
+    def request_keyframe(self):
+
+        # only encoders that code a stream (e.g. avc_stream_encoder) make use of it
+        self.encoder.request_keyframe()
+
+
     def forward(self, inputs):
 
         outputs = CompressionLayer.CompressionLayerFunc.apply(inputs, self.encoder, self.decoder, self.running_stats)
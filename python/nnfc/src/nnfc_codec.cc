@@ -19,6 +19,8 @@ static PyMethodDef NNFCEncoderContext_methods[] = {
       "Encodes a batch of intermediate activations. Expects a PyTorch float tensor as input." },
     { "backward", (PyCFunction)NNFCEncoderContext_backward, METH_VARARGS,
       "Propagates gradients back through this operation." },
+    { "request_keyframe", (PyCFunction)NNFCEncoderContext_request_keyframe, METH_NOARGS,
+      "Makes the next activation a keyframe, for encoders that code a stream. The others ignore it." },
     {NULL, NULL, METH_VARARGS, ""}  // Sentinel
 };
 
@@ -139,14 +139,7 @@ PyObject* NNFCDecoderContext_forward(NNFCDecoderContext *self, PyObject *args){
     
     try {
         std::vector<std::vector<uint8_t>> input_buffers = pylist2buffers(input_pylist);
-        const size_t input_buffers_size = input_buffers.size();
-        std::vector<nn::Tensor<float, 3>> tensors(input_buffers_size);
-
-        #pragma omp parallel for
-        for(size_t i = 0; i < input_buffers.size(); i++) {
-            const nn::Tensor<float, 3> tensor = self->decoder->forward(input_buffers[i]);
-            tensors[i] = std::move(tensor);
-        }
+        const std::vector<nn::Tensor<float, 3>> tensors = self->decoder->forward_batch(input_buffers);
         
         PyObject *array = tensors2blob(tensors);
         return array;
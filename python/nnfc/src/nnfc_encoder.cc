@@ -133,14 +133,7 @@ PyObject* NNFCEncoderContext_forward(NNFCEncoderContext *self, PyObject *args){
 
     try {
         std::vector<nn::Tensor<float, 3>> input_tensors = blob2tensors(input_array);
-        const size_t input_tensors_size = input_tensors.size();
-        std::vector<std::vector<uint8_t>> buffers(input_tensors_size);
-
-        #pragma omp parallel for
-        for(size_t i = 0; i < input_tensors_size; i++) {
-            const std::vector<uint8_t> buffer = self->encoder->forward(input_tensors[i]);
-            buffers[i] = buffer;
-        }
+        const std::vector<std::vector<uint8_t>> buffers = self->encoder->forward_batch(input_tensors);
         
         PyObject *pylist_of_buffer = buffers2pylist(buffers);
         return pylist_of_buffer;
@@ -169,3 +162,16 @@ PyObject* NNFCEncoderContext_backward(NNFCEncoderContext *, PyObject *args){
     return grad_output;
 }
 
+PyObject* NNFCEncoderContext_request_keyframe(NNFCEncoderContext *self, PyObject *){
+
+    try {
+        self->encoder->request_keyframe();
+    }
+    catch(std::exception& e) {
+        std::string error_message = e.what();
+        PyErr_SetString(PyExc_Exception, error_message.c_str());
+        return 0;
+    }
+
+    Py_RETURN_NONE;
+}
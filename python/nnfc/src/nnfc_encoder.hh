@@ -17,5 +17,6 @@ void NNFCEncoderContext_dealloc(NNFCEncoderContext* self);
 
 PyObject* NNFCEncoderContext_forward(NNFCEncoderContext *self, PyObject *args);
 PyObject* NNFCEncoderContext_backward(NNFCEncoderContext *self, PyObject *args);
+PyObject* NNFCEncoderContext_request_keyframe(NNFCEncoderContext *self, PyObject *);
 
 #endif // _NNFC_ENCODER
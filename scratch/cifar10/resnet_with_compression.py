@@ -80,7 +80,7 @@ class ResNetJPEG(nn.Module):
 
         self.timing = False
         self.jpeg_image_compression_layer = CompressionLayer(encoder_name='jpeg_image_encoder',
-                                                        encoder_params_dict={'quantizer' : quantizer},
+                                                        encoder_params_dict={'quantizer' : quantizer, 'entropy_coder' : 0},
                                                         decoder_name='jpeg_image_decoder',
                                                         decoder_params_dict={})
 
@@ -127,7 +127,7 @@ class ResNetEH(nn.Module):
         self.timing = False
         self.layer = layer
         self.jpeg_image_compression_layer = CompressionLayer(encoder_name='jpeg_encoder',
-                                                        encoder_params_dict={'quantizer' : quantizer},
+                                                        encoder_params_dict={'quantizer' : quantizer, 'entropy_coder' : 0, 'layout' : 0},
                                                         decoder_name='jpeg_decoder',
                                                         decoder_params_dict={})
 
@@ -201,7 +201,7 @@ class ResNetMPEG(nn.Module):
         self.timing = False
         self.layer = layer
         self.jpeg_image_compression_layer = CompressionLayer(encoder_name=encoder_name,
-                                                             encoder_params_dict={'quantizer' : quantizer},
+                                                             encoder_params_dict={'quantizer' : quantizer, 'layout' : 0},
                                                              decoder_name=decoder_name,
                                                              decoder_params_dict={})
 
@@ -269,7 +269,7 @@ class ResNetNNFC1(nn.Module):
 
         self.timing = False
         self.nnfc_compression_layer = CompressionLayer(encoder_name='nnfc1_encoder',
-                                                       encoder_params_dict={'quantizer' : quantizer},
+                                                       encoder_params_dict={'quantizer' : quantizer, 'entropy_coder' : 0, 'codebook_refresh' : 0},
                                                        decoder_name='nnfc1_decoder',
                                                        decoder_params_dict={})
 
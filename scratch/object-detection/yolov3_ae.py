@@ -59,7 +59,7 @@ class AutoEncoder1(nn.Module):
         stride = 1
 
         self.compression_layer = CompressionLayer(encoder_name='nnfc1_encoder',
-                                                  encoder_params_dict={'quantizer' : -1},
+                                                  encoder_params_dict={'quantizer' : -1, 'entropy_coder' : 0, 'codebook_refresh' : 0},
                                                   decoder_name='nnfc1_decoder',
                                                   decoder_params_dict={})
         
@@ -157,7 +157,7 @@ class YoloV3(nn.Module):
         #                                           decoder_name='jpeg_decoder',
         #                                           decoder_params_dict={})
         self.compression_layer = CompressionLayer(encoder_name='nnfc1_encoder',
-                                                  encoder_params_dict={'quantizer' : -1},
+                                                  encoder_params_dict={'quantizer' : -1, 'entropy_coder' : 0, 'codebook_refresh' : 0},
                                                   decoder_name='nnfc1_decoder',
                                                   decoder_params_dict={})
         
@@ -79,7 +79,7 @@ class Compressor(nn.Module):
         #                                           decoder_params_dict={})
 
         self.compression_layer = CompressionLayer(encoder_name='nnfc2_encoder',
-                                                  encoder_params_dict={},
+                                                  encoder_params_dict={'probability_model' : 0, 'slices' : 1, 'entropy_coder' : 0, 'dct_method' : 0, 'block_size' : 0},
                                                   decoder_name='nnfc2_decoder',
                                                   decoder_params_dict={})
 
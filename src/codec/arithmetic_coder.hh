@@ -7,11 +7,34 @@
 
 #include <bitset>
 #include <iostream>
+#include <type_traits>
 
 #include "arithmetic_coder_common.hh"
 #include "arithmetic_probability_models.hh"
 
 namespace codec {
+namespace arithmetic_coder {
+// Models that declare a `denominator_bits` constant keep their
+// denominator at exactly 2^denominator_bits (see PowerOfTwoAdaptiveModel),
+// which turns scaling the range by a symbol's probability into a shift.
+template <class Model, class = void>
+struct has_power_of_two_denominator : std::false_type {};
+
+template <class Model>
+struct has_power_of_two_denominator<
+    Model, std::void_t<decltype(Model::denominator_bits)>> : std::true_type {
+};
+
+template <class Model>
+inline uint64_t scale_range(const Model& model, const uint64_t numerator,
+                            const uint64_t range) {
+  if constexpr (has_power_of_two_denominator<Model>::value) {
+    return (numerator * range) >> Model::denominator_bits;
+  } else {
+    return (numerator * range) / model.denominator();
+  }
+}
+}  // namespace arithmetic_coder
 
 //////////////////////////////////////////////////////////////////////
 // Infinite Bit Vector
@@ -187,27 +210,28 @@ class ArithmeticEncoder {
         model_.symbol_numerator(symbol);
     const uint64_t sym_high = sym_prob.second;
     const uint64_t sym_low = sym_prob.first;
-    const uint32_t denominator = model_.denominator();
     assert(sym_high > sym_low);
 
-    model_.consume_symbol(symbol);
-
     // check if overflow would happen
     assert((range >= 1) or
            (sym_high < (std::numeric_limits<uint64_t>::max() / range)));
     assert((range >= 1) or
            (sym_low < (std::numeric_limits<uint64_t>::max() / range)));
 
-    assert((denominator >= 1) and
+    assert((model_.denominator() >= 1) and
            (low_ < (std::numeric_limits<uint64_t>::max() -
-                    (range * sym_high) / denominator) +
+                    (range * sym_high) / model_.denominator()) +
                        1));
-    assert((denominator >= 1) and
+    assert((model_.denominator() >= 1) and
            (low_ < (std::numeric_limits<uint64_t>::max() -
-                    (range * sym_low) / denominator)));
+                    (range * sym_low) / model_.denominator())));
 
-    const uint64_t new_high = low_ + (sym_high * range) / denominator - 1;
-    const uint64_t new_low = low_ + (sym_low * range) / denominator;
+    const uint64_t new_high =
+        low_ + arithmetic_coder::scale_range(model_, sym_high, range) - 1;
+    const uint64_t new_low =
+        low_ + arithmetic_coder::scale_range(model_, sym_low, range);
+
+    model_.consume_symbol(symbol);
 
     assert(new_high <= arithmetic_coder::working_bits_max);
     assert(new_low <= arithmetic_coder::working_bits_max);
@@ -361,7 +385,6 @@ class ArithmeticDecoder {
     for (uint64_t sym_idx = 0; sym_idx < model_.size(); sym_idx++) {
       const std::pair<uint64_t, uint64_t> sym_prob =
           model_.symbol_numerator(sym_idx);
-      const uint32_t denominator = model_.denominator();
       assert(sym_prob.second > sym_prob.first);
 
       // check if overflow would happen
@@ -370,17 +393,19 @@ class ArithmeticDecoder {
       assert((range >= 1) or
              (sym_prob.first < (std::numeric_limits<uint64_t>::max() / range)));
 
-      assert((denominator >= 1) and
+      assert((model_.denominator() >= 1) and
              (low_ < (std::numeric_limits<uint64_t>::max() -
-                      (range * sym_prob.second) / denominator) +
+                      (range * sym_prob.second) / model_.denominator()) +
                          1));
-      assert((denominator >= 1) and
+      assert((model_.denominator() >= 1) and
              (low_ < (std::numeric_limits<uint64_t>::max() -
-                      (range * sym_prob.first) / denominator)));
+                      (range * sym_prob.first) / model_.denominator())));
 
       const uint64_t sym_high =
-          low_ + (sym_prob.second * range) / denominator - 1;
-      const uint64_t sym_low = low_ + (sym_prob.first * range) / denominator;
+          low_ + arithmetic_coder::scale_range(model_, sym_prob.second, range) -
+          1;
+      const uint64_t sym_low =
+          low_ + arithmetic_coder::scale_range(model_, sym_prob.first, range);
 
       assert(sym_high <= arithmetic_coder::working_bits_max);
       assert(sym_low <= arithmetic_coder::working_bits_max);
@@ -491,13 +516,15 @@ class FastArithmeticDecoder {
 
   inline void shift() {
     // grab the MSB of `low` (will be the same as `high`)
-    const uint8_t bit = (low_ >> (arithmetic_coder::num_working_bits - 1));
-    assert(bit <= 0x1);
-    assert(bit == (high_ >> (arithmetic_coder::num_working_bits - 1)));
-    assert((!!(high_ & arithmetic_coder::top_mask)) == bit);
+    assert((low_ >> (arithmetic_coder::num_working_bits - 1)) <= 0x1);
+    assert((low_ >> (arithmetic_coder::num_working_bits - 1)) ==
+           (high_ >> (arithmetic_coder::num_working_bits - 1)));
+    assert((!!(high_ & arithmetic_coder::top_mask)) ==
+           (low_ >> (arithmetic_coder::num_working_bits - 1)));
 
     assert(((value_ & arithmetic_coder::top_mask) >>
-            (arithmetic_coder::num_working_bits - 1)) == bit);
+            (arithmetic_coder::num_working_bits - 1)) ==
+           (low_ >> (arithmetic_coder::num_working_bits - 1)));
 
     uint8_t bitvector_bit = 0;
     if (bit_idx_ < data_.size()) {
@@ -557,10 +584,11 @@ class FastArithmeticDecoder {
 
     const std::pair<uint64_t, uint64_t> sym_prob =
         model_.symbol_numerator(symbol);
-    const uint32_t denominator = model_.denominator();
     const uint64_t sym_high =
-        low_ + (sym_prob.second * range) / denominator - 1;
-    const uint64_t sym_low = low_ + (sym_prob.first * range) / denominator;
+        low_ + arithmetic_coder::scale_range(model_, sym_prob.second, range) -
+        1;
+    const uint64_t sym_low =
+        low_ + arithmetic_coder::scale_range(model_, sym_prob.first, range);
 
     high_ = sym_high;
     low_ = sym_low;
@@ -1,6 +1,7 @@
 #ifndef _CODEC_ARITHMETIC_PROBABILITY_MODELS_HH
 #define _CODEC_ARITHMETIC_PROBABILITY_MODELS_HH
 
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <string>
@@ -12,6 +13,20 @@
 
 namespace codec {
 
+//////////////////////////////////////////////////////////////////////
+// Probability Table
+//
+// Symbol frequencies trained offline (see
+// src/frontend/train_probability_model). `frequencies` holds
+// `num_symbols + 1` entries, the last one being the end-of-message
+// symbol. Tables are meant to live in constexpr arrays so that
+// seeding a model from one costs a single pass over the symbols.
+//////////////////////////////////////////////////////////////////////
+struct ProbabilityTable {
+  uint32_t num_symbols;
+  const uint32_t* frequencies;
+};
+
 class SimpleModel {
  private:
   const std::vector<std::pair<uint32_t, uint32_t>> numerator_;
@@ -95,6 +110,19 @@ class SimpleAdaptiveModel {
       numerator_[num_symbols_].second = upper;      
   }
 
+  SimpleAdaptiveModel(const ProbabilityTable table)
+      : num_symbols_(table.num_symbols + 1),
+        numerator_(table.num_symbols + 1),
+        denominator_(0) {
+    for (uint32_t i = 0; i < num_symbols_; i++) {
+      assert(table.frequencies[i] > 0);
+      numerator_[i].first = denominator_;
+      denominator_ += table.frequencies[i];
+      numerator_[i].second = denominator_;
+    }
+    assert(denominator_ < arithmetic_coder::min_range);
+  }
+
   ~SimpleAdaptiveModel() {}
     
   inline void consume_symbol(const uint32_t symbol) {
@@ -162,10 +190,18 @@ class FastAdaptiveModel {
     }
   }
 
-  // SimpleAdaptiveModel(const std::string probabilities_json)
-  //     : num_symbols_(), numerator_(), denominator_() {
-  //   nlohmann::json model_json = nlohmann::json::parse(probabilities_json);
-  // }
+  FastAdaptiveModel(const ProbabilityTable table)
+      : num_symbols_(table.num_symbols + 1),
+        numerator_(table.num_symbols + 1),
+        denominator_(0) {
+    for (uint32_t i = 0; i < num_symbols_; i++) {
+      assert(table.frequencies[i] > 0);
+      numerator_[i].first = denominator_;
+      denominator_ += table.frequencies[i];
+      numerator_[i].second = denominator_;
+    }
+    assert(denominator_ < arithmetic_coder::min_range);
+  }
 
   ~FastAdaptiveModel() {}
 
@@ -222,6 +258,153 @@ class FastAdaptiveModel {
 
   inline uint32_t finished_symbol() const { return num_symbols_ - 1; }
 };
+
+//////////////////////////////////////////////////////////////////////
+// Power Of Two Adaptive Model
+//
+// Adaptive model whose denominator is always exactly
+// 2^denominator_bits, so the arithmetic coder scales its range with a
+// shift instead of a division. Symbol counts adapt on every symbol and
+// are periodically renormalized into frequencies with that total; the
+// period starts short and doubles up to `max_update_interval`.
+// `find_symbol` is a binary search, which makes this model a good fit
+// for the FastArithmeticDecoder.
+//////////////////////////////////////////////////////////////////////
+class PowerOfTwoAdaptiveModel {
+ public:
+  static constexpr uint32_t denominator_bits = 15;
+
+ private:
+  static constexpr uint32_t count_increment = 32;
+  static constexpr uint32_t max_total_count = 1 << 16;
+  static constexpr uint32_t min_update_interval = 16;
+  static constexpr uint32_t max_update_interval = 1024;
+
+  const uint32_t num_symbols_;
+  std::vector<uint32_t> counts_;
+  uint32_t total_count_;
+  std::vector<std::pair<uint32_t, uint32_t>> numerator_;
+
+  uint32_t update_interval_;
+  uint32_t symbols_until_update_;
+
+  inline void halve_counts() {
+    total_count_ = 0;
+    for (uint32_t& count : counts_) {
+      count = (count + 1) / 2;
+      total_count_ += count;
+    }
+  }
+
+  // Turns the counts into frequencies that sum to exactly
+  // 2^denominator_bits. Every symbol keeps at least a frequency of one
+  // and the rounding error goes to the most frequent symbol. The single
+  // division is amortized over the whole update interval.
+  void renormalize() {
+    const uint32_t denominator = 1 << denominator_bits;
+    const uint64_t spare = denominator - num_symbols_;
+    const uint64_t reciprocal = (spare << 32) / total_count_;
+
+    std::vector<uint32_t> frequencies(num_symbols_);
+    uint32_t sum = 0;
+    uint32_t most_frequent = 0;
+    for (uint32_t i = 0; i < num_symbols_; i++) {
+      frequencies[i] = 1 + ((counts_[i] * reciprocal) >> 32);
+      sum += frequencies[i];
+      if (counts_[i] > counts_[most_frequent]) {
+        most_frequent = i;
+      }
+    }
+    assert(sum <= denominator);
+    frequencies[most_frequent] += denominator - sum;
+
+    uint32_t cumulative = 0;
+    for (uint32_t i = 0; i < num_symbols_; i++) {
+      numerator_[i].first = cumulative;
+      cumulative += frequencies[i];
+      numerator_[i].second = cumulative;
+    }
+    assert(cumulative == denominator);
+  }
+
+ public:
+  PowerOfTwoAdaptiveModel(const uint32_t num_symbols)
+      : num_symbols_(num_symbols + 1),
+        counts_(num_symbols + 1, 1),
+        total_count_(num_symbols + 1),
+        numerator_(num_symbols + 1),
+        update_interval_(min_update_interval),
+        symbols_until_update_(min_update_interval) {
+    assert(num_symbols_ <= (1u << denominator_bits));
+    renormalize();
+  }
+
+  PowerOfTwoAdaptiveModel(const ProbabilityTable table)
+      : num_symbols_(table.num_symbols + 1),
+        counts_(table.frequencies, table.frequencies + table.num_symbols + 1),
+        total_count_(0),
+        numerator_(table.num_symbols + 1),
+        update_interval_(min_update_interval),
+        symbols_until_update_(min_update_interval) {
+    assert(num_symbols_ <= (1u << denominator_bits));
+    for (const uint32_t count : counts_) {
+      assert(count > 0);
+      total_count_ += count;
+    }
+    while (total_count_ > max_total_count) {
+      halve_counts();
+    }
+    renormalize();
+  }
+
+  ~PowerOfTwoAdaptiveModel() {}
+
+  inline uint32_t find_symbol(const uint64_t high, const uint64_t low,
+                              const uint64_t value) const {
+    const uint64_t range = high - low + 1;
+
+    // the last symbol whose interval starts at or below `value`
+    uint32_t first = 0;
+    uint32_t last = num_symbols_ - 1;
+    while (first < last) {
+      const uint32_t middle = (first + last + 1) / 2;
+      const uint64_t sym_low =
+          low + ((numerator_[middle].first * range) >> denominator_bits);
+      if (sym_low <= value) {
+        first = middle;
+      } else {
+        last = middle - 1;
+      }
+    }
+    return first;
+  }
+
+  inline void consume_symbol(const uint32_t symbol) {
+    counts_[symbol] += count_increment;
+    total_count_ += count_increment;
+    if (total_count_ > max_total_count) {
+      halve_counts();
+    }
+
+    if (--symbols_until_update_ == 0) {
+      renormalize();
+      update_interval_ = std::min(2 * update_interval_, max_update_interval);
+      symbols_until_update_ = update_interval_;
+    }
+  }
+
+  inline std::pair<uint32_t, uint32_t> symbol_numerator(
+      const uint32_t symbol) const {
+    assert(symbol <= num_symbols_);
+    return numerator_[symbol];
+  }
+
+  inline uint32_t denominator() const { return 1 << denominator_bits; }
+
+  inline uint32_t size() const { return num_symbols_; }
+
+  inline uint32_t finished_symbol() const { return num_symbols_ - 1; }
+};
 }  // namespace codec
 
 #endif  // _CODEC_ARITHMETIC_PROBABILITY_MODELS_HH
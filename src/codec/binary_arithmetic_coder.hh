@@ -0,0 +1,236 @@
+#ifndef _CODEC_BINARY_ARITHMETIC_CODER_HH
+#define _CODEC_BINARY_ARITHMETIC_CODER_HH
+
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// constants (trying to avoid polluting the `codec` namespace)
+namespace codec {
+namespace binary_arithmetic_coder {
+// probabilities are fixed point with `probability_bits` fractional bits
+static constexpr uint32_t probability_bits = 11;
+static constexpr uint32_t probability_one = 1 << probability_bits;
+
+// a context moves 1/2^adaptation_shift of the way towards every bin it sees
+static constexpr uint32_t adaptation_shift = 5;
+
+// the range is renormalized one byte at a time once it drops below this
+static constexpr uint32_t top_value = 1 << 24;
+}  // namespace binary_arithmetic_coder
+
+//////////////////////////////////////////////////////////////////////
+// Binary Context
+//
+// Adaptive estimate of the probability that the next bin is a 0. The
+// update is a shift and an add, so coding a bin never divides.
+//////////////////////////////////////////////////////////////////////
+class BinaryContext {
+ private:
+  uint16_t probability_;
+
+ public:
+  BinaryContext()
+      : probability_(binary_arithmetic_coder::probability_one / 2) {}
+
+  inline uint32_t probability() const { return probability_; }
+
+  inline void update(const uint32_t bit) {
+    if (bit) {
+      probability_ -= probability_ >> binary_arithmetic_coder::adaptation_shift;
+    } else {
+      probability_ +=
+          (binary_arithmetic_coder::probability_one - probability_) >>
+          binary_arithmetic_coder::adaptation_shift;
+    }
+  }
+};
+
+//////////////////////////////////////////////////////////////////////
+// Binary Arithmetic Encoder
+//
+// A byte-oriented range coder for binary decisions (the same engine as
+// LZMA's). Bins are either coded with a `BinaryContext` or bypassed at
+// a fixed probability of 1/2.
+//////////////////////////////////////////////////////////////////////
+class BinaryArithmeticEncoder {
+ private:
+  std::vector<char> data_;
+
+  uint64_t low_;
+  uint32_t range_;
+
+  // a byte that may still receive a carry, followed by `pending_`
+  // 0xFF bytes that would carry along with it
+  uint8_t cache_;
+  uint64_t pending_;
+
+  bool finished_;
+
+  inline void shift_low() {
+    if (static_cast<uint32_t>(low_) < 0xFF000000 or (low_ >> 32) != 0) {
+      const uint8_t carry = static_cast<uint8_t>(low_ >> 32);
+      uint8_t byte = cache_;
+      do {
+        data_.push_back(static_cast<char>(byte + carry));
+        byte = 0xFF;
+      } while (--pending_ != 0);
+      cache_ = static_cast<uint8_t>(low_ >> 24);
+    }
+    pending_++;
+    low_ = (low_ & 0x00FFFFFF) << 8;
+  }
+
+  inline void normalize() {
+    while (range_ < binary_arithmetic_coder::top_value) {
+      range_ <<= 8;
+      shift_low();
+    }
+  }
+
+ public:
+  BinaryArithmeticEncoder()
+      : data_(),
+        low_(0),
+        range_(0xFFFFFFFF),
+        cache_(0),
+        pending_(1),
+        finished_(false) {}
+
+  ~BinaryArithmeticEncoder() {}
+
+  inline void encode_bit(BinaryContext& context, const uint32_t bit) {
+    assert(not finished_);
+
+    const uint32_t bound =
+        (range_ >> binary_arithmetic_coder::probability_bits) *
+        context.probability();
+    if (bit) {
+      low_ += bound;
+      range_ -= bound;
+    } else {
+      range_ = bound;
+    }
+    context.update(bit);
+
+    normalize();
+  }
+
+  inline void encode_bypass(const uint32_t bit) {
+    assert(not finished_);
+
+    range_ >>= 1;
+    if (bit) {
+      low_ += range_;
+    }
+
+    normalize();
+  }
+
+  // writes the `num_bits` low bits of `value`, most significant first
+  inline void encode_bypass_bits(const uint32_t value,
+                                 const uint32_t num_bits) {
+    for (uint32_t i = num_bits; i > 0; i--) {
+      encode_bypass((value >> (i - 1)) & 0x1);
+    }
+  }
+
+  std::vector<char> finish() {
+    if (finished_) {
+      throw std::runtime_error(
+          "`finished` already called, cannot encode more bins.");
+    }
+    finished_ = true;
+
+    for (int i = 0; i < 5; i++) {
+      shift_low();
+    }
+
+    return data_;
+  }
+};
+
+//////////////////////////////////////////////////////////////////////
+// Binary Arithmetic Decoder
+//////////////////////////////////////////////////////////////////////
+class BinaryArithmeticDecoder {
+ private:
+  const std::vector<char> data_;
+  size_t byte_idx_;
+
+  uint32_t range_;
+  uint32_t code_;
+
+  // reading past the end of the data yields zeros, just like the
+  // trailing bits of the multi-symbol decoder
+  inline uint8_t next_byte() {
+    if (byte_idx_ < data_.size()) {
+      return static_cast<uint8_t>(data_[byte_idx_++]);
+    }
+    byte_idx_++;
+    return 0;
+  }
+
+  inline void normalize() {
+    while (range_ < binary_arithmetic_coder::top_value) {
+      range_ <<= 8;
+      code_ = (code_ << 8) | next_byte();
+    }
+  }
+
+ public:
+  BinaryArithmeticDecoder(std::vector<char> data)
+      : data_(data), byte_idx_(0), range_(0xFFFFFFFF), code_(0) {
+    // the encoder always starts with a zero byte (the initial cache)
+    for (int i = 0; i < 5; i++) {
+      code_ = (code_ << 8) | next_byte();
+    }
+  }
+
+  ~BinaryArithmeticDecoder() {}
+
+  inline uint32_t decode_bit(BinaryContext& context) {
+    const uint32_t bound =
+        (range_ >> binary_arithmetic_coder::probability_bits) *
+        context.probability();
+
+    uint32_t bit;
+    if (code_ < bound) {
+      range_ = bound;
+      bit = 0;
+    } else {
+      code_ -= bound;
+      range_ -= bound;
+      bit = 1;
+    }
+    context.update(bit);
+
+    normalize();
+    return bit;
+  }
+
+  inline uint32_t decode_bypass() {
+    range_ >>= 1;
+
+    uint32_t bit = 0;
+    if (code_ >= range_) {
+      code_ -= range_;
+      bit = 1;
+    }
+
+    normalize();
+    return bit;
+  }
+
+  inline uint32_t decode_bypass_bits(const uint32_t num_bits) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < num_bits; i++) {
+      value = (value << 1) | decode_bypass();
+    }
+    return value;
+  }
+};
+}  // namespace codec
+
+#endif  // _CODEC_BINARY_ARITHMETIC_CODER_HH
@@ -1,8 +1,11 @@
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <vector>
 
 #include "codec/tjdct/jsimd.hh"
 #include "fastdct.hh"
+#include "fastdct_simd.hh"
 #include "nn/tensor.hh"
 
 static constexpr int alignment = 16;
@@ -17,64 +20,220 @@ inline std::unique_ptr<int16_t, void (*)(void *)> tj_data(
   return std::move(data);
 }
 
-codec::FastDCT::FastDCT()
-    : divisors_(std::move(tj_data(sizeof(divisors), divisors))),
+// the number of blocks `kernel` should transform next, out of `remaining`
+static int batch_size(const codec::DCTKernel kernel, const int remaining) {
+  int batch = static_cast<int>(kernel);
+  while (batch > remaining) {
+    batch /= 2;
+  }
+  return batch;
+}
+
+static codec::DCTKernel detect_dct_kernel() {
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512bw")) {
+    return codec::DCTKernel::AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return codec::DCTKernel::AVX2;
+  }
+  return codec::DCTKernel::SSE2;
+}
+
+// the AAN scale factors of the IFAST transforms, in units of 2^-14
+// (from libjpeg's jcdctmgr.c)
+static constexpr int16_t aan_scales[] = {
+    16384, 22725, 21407, 19266, 16384, 12873, 8867,  4520,  //
+    22725, 31521, 29692, 26722, 22725, 17855, 12299, 6270,  //
+    21407, 29692, 27969, 25172, 21407, 16819, 11585, 5906,  //
+    19266, 26722, 25172, 22654, 19266, 15137, 10426, 5315,  //
+    16384, 22725, 21407, 19266, 16384, 12873, 8867,  4520,  //
+    12873, 17855, 16819, 15137, 12873, 10114, 6967,  3552,  //
+    8867,  12299, 11585, 10426, 8867,  6967,  4799,  2446,  //
+    4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247,
+};
+
+codec::DCTKernel codec::best_dct_kernel() {
+  static const DCTKernel kernel = detect_dct_kernel();
+  return kernel;
+}
+
+codec::FastDCT::FastDCT(const DCTKernel kernel, const DCTMethod method)
+    : kernel_(kernel),
+      method_(method),
+      divisors_(std::move(tj_data(sizeof(divisors), divisors))),
       work_buffer_(static_cast<int16_t *>(std::aligned_alloc(alignment, 128)),
                    [](void *ptr) { std::free(ptr); }) {}
 
 codec::FastDCT::~FastDCT() {}
 
-void codec::FastDCT::dct_inplace(nn::Tensor<int16_t, 3> input) const {
-  const int channels = input.dimension(0);
-  const int rows = input.dimension(1);
-  const int cols = input.dimension(2);
+float codec::FastDCT::coefficient_scale(const DCTMethod method,
+                                        const int index) {
+  // IFAST skips the quantization step, which would divide by 8, and
+  // leaves the AAN scale factors in
+  return method == DCTMethod::IFAST ? aan_scales[index] / 2048.f : 1.f;
+}
 
+void codec::FastDCT::dct_plane(const int16_t *plane, const size_t stride,
+                               const int num_blocks,
+                               int16_t *coefficients) const {
   int16_t *data = work_buffer_.get();
 
-  for (int channel = 0; channel < channels; channel++) {
-    for (int row_offset = 0; row_offset < rows; row_offset += 8) {
-      for (int col_offset = 0; col_offset < cols; col_offset += 8) {
-        // fill buffer
+  for (int block = 0; block < num_blocks;) {
+    // only ISLOW has kernels wider than SSE2
+    const int batch = method_ == DCTMethod::ISLOW
+                          ? batch_size(kernel_, num_blocks - block)
+                          : 1;
+    const int16_t *batch_plane = plane + 8 * block;
+    int16_t *batch_coefficients = coefficients + 64 * block;
+
+    switch (batch) {
+      case 4:
+        fastdct_simd::fdct_quantize_plane_avx512(batch_plane, stride,
+                                                 divisors_.get(),
+                                                 batch_coefficients);
+        break;
+      case 2:
+        fastdct_simd::fdct_quantize_plane_avx2(batch_plane, stride,
+                                               divisors_.get(),
+                                               batch_coefficients);
+        break;
+      default:
+        // the assembly wants the level shifted block in an aligned buffer
         for (int row = 0; row < 8; row++) {
           for (int col = 0; col < 8; col++) {
-            data[8 * row + col] =
-                input(channel, row_offset + row, col_offset + col) - 128;
+            data[8 * row + col] = batch_plane[row * stride + col] - 128;
           }
         }
 
         // perform dct and scale
-        // jsimd_fdct_ifast_sse2(data);
-        jsimd_fdct_islow_sse2(data);
-        jsimd_quantize_sse2(data, divisors_.get(), data);
+        if (method_ == DCTMethod::IFAST) {
+          jsimd_fdct_ifast_sse2(data);
+        } else {
+          jsimd_fdct_islow_sse2(data);
+          jsimd_quantize_sse2(data, divisors_.get(), data);
+        }
+        std::memcpy(batch_coefficients, data, 64 * sizeof(int16_t));
+        break;
+    }
+
+    block += batch;
+  }
+}
+
+// transforms every row of blocks of `input` into `output`, which may be
+// the same tensor
+static void dct_tensor(const codec::FastDCT &dct,
+                       const nn::Tensor<int16_t, 3> input,
+                       nn::Tensor<int16_t, 3> output) {
+  const int channels = input.dimension(0);
+  const int rows = input.dimension(1);
+  const int cols = input.dimension(2);
+
+  // the coefficients of a row of blocks
+  std::vector<int16_t> coefficients(8 * cols);
+
+  for (int channel = 0; channel < channels; channel++) {
+    for (int row_offset = 0; row_offset < rows; row_offset += 8) {
+      dct.dct_plane(&input(channel, row_offset, 0), cols, cols / 8,
+                    coefficients.data());
 
-        // put data back into tensor
+      // put data back into tensor
+      for (int col_offset = 0; col_offset < cols; col_offset += 8) {
+        const int16_t *block = &coefficients[8 * col_offset];
         for (int row = 0; row < 8; row++) {
-          for (int col = 0; col < 8; col++) {
-            input(channel, row_offset + row, col_offset + col) =
-                data[8 * row + col];
-          }
+          std::memcpy(&output(channel, row_offset + row, col_offset),
+                      block + 8 * row, 8 * sizeof(int16_t));
         }
       }
     }
   }
 }
 
+void codec::FastDCT::dct_inplace(nn::Tensor<int16_t, 3> input) const {
+  dct_tensor(*this, input, input);
+}
+
 // expects inputs between [0, 255]
 nn::Tensor<int16_t, 3> codec::FastDCT::operator()(
     const nn::Tensor<int16_t, 3> input) const {
-  nn::Tensor<int16_t, 3> output(input.deepcopy());
-  dct_inplace(output);
+  nn::Tensor<int16_t, 3> output(input.dimension(0), input.dimension(1),
+                                input.dimension(2));
+  dct_tensor(*this, input, output);
 
   return std::move(output);
 }
 
-codec::FastIDCT::FastIDCT()
-    : dct_table_(std::move(tj_data(sizeof(dct_table), dct_table))),
+codec::FastIDCT::FastIDCT(const DCTKernel kernel, const DCTMethod method)
+    : kernel_(kernel),
+      method_(method),
+      dct_table_(std::move(tj_data(sizeof(dct_table), dct_table))),
       work_buffer_(static_cast<int16_t *>(std::aligned_alloc(alignment, 128)),
                    [](void *ptr) { std::free(ptr); }) {}
 
 codec::FastIDCT::~FastIDCT() {}
 
+float codec::FastIDCT::coefficient_scale(const DCTMethod method,
+                                         const int index) {
+  // the IFAST dequantization multipliers carry the AAN scale factors with
+  // two extra fractional bits, which we fold into the coefficients
+  return method == DCTMethod::IFAST ? aan_scales[index] / 4096.f : 1.f;
+}
+
+void codec::FastIDCT::idct_block(const int16_t *coefficients,
+                                 nn::Tensor<uint8_t, 3> output,
+                                 const int channel, const int row_offset,
+                                 const int col_offset) const {
+  idct_blocks(coefficients, output, channel, row_offset, col_offset, 1);
+}
+
+void codec::FastIDCT::idct_blocks(const int16_t *coefficients,
+                                  nn::Tensor<uint8_t, 3> output,
+                                  const int channel, const int row_offset,
+                                  const int col_offset,
+                                  const int num_blocks) const {
+  uint8_t *outdata[8];
+
+  for (int block = 0; block < num_blocks;) {
+    // only ISLOW has kernels wider than SSE2
+    const int batch = method_ == DCTMethod::ISLOW
+                          ? batch_size(kernel_, num_blocks - block)
+                          : 1;
+    const int16_t *batch_coefficients = coefficients + 64 * block;
+
+    for (int row = 0; row < 8; row++) {
+      outdata[row] = &output(channel, row_offset + row, col_offset + 8 * block);
+    }
+
+    // perform idct and descale
+    switch (batch) {
+      case 4:
+        fastdct_simd::idct_islow_avx512(dct_table_.get(), batch_coefficients,
+                                        outdata, 0);
+        break;
+      case 2:
+        fastdct_simd::idct_islow_avx2(dct_table_.get(), batch_coefficients,
+                                      outdata, 0);
+        break;
+      default: {
+        // the assembly wants an aligned buffer
+        int16_t *data = work_buffer_.get();
+        std::memcpy(data, batch_coefficients, 64 * sizeof(int16_t));
+
+        if (method_ == DCTMethod::IFAST) {
+          jsimd_idct_ifast_sse2(dct_table_.get(), data, outdata, 0);
+        } else {
+          jsimd_idct_islow_sse2(dct_table_.get(), data, outdata, 0);
+        }
+        break;
+      }
+    }
+
+    block += batch;
+  }
+}
+
 nn::Tensor<uint8_t, 3> codec::FastIDCT::operator()(
     const nn::Tensor<int16_t, 3> input) const {
   const int channels = input.dimension(0);
@@ -83,33 +242,22 @@ nn::Tensor<uint8_t, 3> codec::FastIDCT::operator()(
 
   nn::Tensor<uint8_t, 3> output(channels, rows, cols);
 
-  int16_t *data = work_buffer_.get();
-  uint8_t *outdata[8];
+  // the coefficients of a row of blocks
+  std::vector<int16_t> coefficients(8 * cols);
 
   for (int channel = 0; channel < channels; channel++) {
     for (int row_offset = 0; row_offset < rows; row_offset += 8) {
       for (int col_offset = 0; col_offset < cols; col_offset += 8) {
-        // fill buffer
+        int16_t *block = &coefficients[8 * col_offset];
         for (int row = 0; row < 8; row++) {
-          for (int col = 0; col < 8; col++) {
-            data[8 * row + col] =
-                input(channel, row_offset + row, col_offset + col);
-          }
+          std::memcpy(block + 8 * row,
+                      &input(channel, row_offset + row, col_offset),
+                      8 * sizeof(int16_t));
         }
-
-        outdata[0] = &output(channel, row_offset, col_offset);
-        outdata[1] = &output(channel, row_offset + 1, col_offset);
-        outdata[2] = &output(channel, row_offset + 2, col_offset);
-        outdata[3] = &output(channel, row_offset + 3, col_offset);
-        outdata[4] = &output(channel, row_offset + 4, col_offset);
-        outdata[5] = &output(channel, row_offset + 5, col_offset);
-        outdata[6] = &output(channel, row_offset + 6, col_offset);
-        outdata[7] = &output(channel, row_offset + 7, col_offset);
-
-        // perform idct and descale
-        // jsimd_idct_ifast_sse2(dct_table_.get(), data, outdata, 0);
-        jsimd_idct_islow_sse2(dct_table_.get(), data, outdata, 0);
       }
+
+      idct_blocks(coefficients.data(), output, channel, row_offset, 0,
+                  cols / 8);
     }
   }
 
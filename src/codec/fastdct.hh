@@ -1,33 +1,78 @@
 #ifndef _CODEC_FASTDCT_HH
 #define _CODEC_FASTDCT_HH
 
+#include <cstddef>
 #include <memory>
 #include "nn/tensor.hh"
 
 namespace codec {
 
+// The SIMD kernels behind the transforms. The value of each is the
+// number of 8x8 blocks it transforms per call.
+enum class DCTKernel { SSE2 = 1, AVX2 = 2, AVX512 = 4 };
+
+// the widest kernel the CPU we are running on supports
+DCTKernel best_dct_kernel();
+
+// The libjpeg-turbo integer DCTs. ISLOW is the accurate one. IFAST (the
+// AAN algorithm) is faster but less accurate, only has an SSE2 kernel and
+// leaves every coefficient scaled by a factor of its own (see
+// coefficient_scale).
+enum class DCTMethod { ISLOW = 0, IFAST = 1 };
+
 class FastDCT {
  private:
+  const DCTKernel kernel_;
+  const DCTMethod method_;
   const std::unique_ptr<int16_t, void (*)(void*)> divisors_;
   std::unique_ptr<int16_t, void (*)(void*)> work_buffer_;
 
  public:
-  FastDCT();
+  FastDCT(const DCTKernel kernel = best_dct_kernel(),
+          const DCTMethod method = DCTMethod::ISLOW);
   ~FastDCT();
 
+  // the factor `method` leaves coefficient `index` (row-major) of a block
+  // scaled by, relative to ISLOW
+  static float coefficient_scale(const DCTMethod method, const int index);
+
+  // Level shifts, transforms and quantizes `num_blocks` horizontally
+  // adjacent 8x8 blocks of [0, 255] samples, the first of which has its
+  // top left corner at `plane` (rows are `stride` elements apart). The 64
+  // row-major coefficients of every block are written to `coefficients`,
+  // one block after the other.
+  void dct_plane(const int16_t *plane, const size_t stride,
+                 const int num_blocks, int16_t *coefficients) const;
   void dct_inplace(nn::Tensor<int16_t, 3> input) const;
   nn::Tensor<int16_t, 3> operator()(const nn::Tensor<int16_t, 3> input) const;
 };
 
 class FastIDCT {
  private:
+  const DCTKernel kernel_;
+  const DCTMethod method_;
   const std::unique_ptr<int16_t, void (*)(void*)> dct_table_;
   std::unique_ptr<int16_t, void (*)(void*)> work_buffer_;
 
  public:
-  FastIDCT();
+  FastIDCT(const DCTKernel kernel = best_dct_kernel(),
+           const DCTMethod method = DCTMethod::ISLOW);
   ~FastIDCT();
 
+  // the factor `method` expects coefficient `index` (row-major) of a
+  // block to be scaled by, relative to ISLOW
+  static float coefficient_scale(const DCTMethod method, const int index);
+
+  // inverse transforms 64 coefficients (row-major) into the 8x8 block of
+  // `output` whose top left corner is at (channel, row_offset, col_offset)
+  void idct_block(const int16_t *coefficients, nn::Tensor<uint8_t, 3> output,
+                  const int channel, const int row_offset,
+                  const int col_offset) const;
+  // same for `num_blocks` horizontally adjacent blocks, whose
+  // coefficients follow each other in `coefficients`
+  void idct_blocks(const int16_t *coefficients, nn::Tensor<uint8_t, 3> output,
+                   const int channel, const int row_offset,
+                   const int col_offset, const int num_blocks) const;
   nn::Tensor<uint8_t, 3> operator()(const nn::Tensor<int16_t, 3> input) const;
 };
 }  // namespace codec
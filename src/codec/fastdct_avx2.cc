@@ -0,0 +1,140 @@
+#include <immintrin.h>
+#include <cstdint>
+
+#include "fastdct_simd.hh"
+
+// everything below (including the kernel templates) is compiled for
+// AVX2, whatever the rest of the build targets
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace {
+// two blocks, one in each 128-bit lane
+struct AVX2 {
+  typedef __m256i vec;
+  static constexpr int blocks = 2;
+
+  // a row of the first block and the same row of the second block,
+  // which starts `block_stride` elements later
+  static inline vec load_rows(const int16_t *row, const size_t block_stride) {
+    const __m128i first =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row));
+    const __m128i second =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + block_stride));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+  }
+
+  static inline void store_rows(int16_t *row, const size_t block_stride,
+                                const vec value) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(row),
+                     _mm256_castsi256_si128(value));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(row + block_stride),
+                     _mm256_extracti128_si256(value, 1));
+  }
+
+  static inline vec broadcast_row(const int16_t *row) {
+    return _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row)));
+  }
+
+  // the low and high 8 bytes of each lane go to `first` and `second`
+  static inline void store_row_pair(const vec value, uint8_t *first,
+                                    uint8_t *second) {
+    const __m128i lanes[2] = {_mm256_castsi256_si128(value),
+                              _mm256_extracti128_si256(value, 1)};
+    for (int block = 0; block < blocks; block++) {
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(first + 8 * block),
+                       lanes[block]);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(second + 8 * block),
+                       _mm_unpackhi_epi64(lanes[block], lanes[block]));
+    }
+  }
+
+  static inline vec zero() { return _mm256_setzero_si256(); }
+  static inline vec set1_8(const char x) { return _mm256_set1_epi8(x); }
+  static inline vec set1_16(const int16_t x) { return _mm256_set1_epi16(x); }
+  static inline vec set1_32(const int32_t x) { return _mm256_set1_epi32(x); }
+
+  static inline vec add16(const vec a, const vec b) {
+    return _mm256_add_epi16(a, b);
+  }
+  static inline vec sub16(const vec a, const vec b) {
+    return _mm256_sub_epi16(a, b);
+  }
+  static inline vec add32(const vec a, const vec b) {
+    return _mm256_add_epi32(a, b);
+  }
+  static inline vec sub32(const vec a, const vec b) {
+    return _mm256_sub_epi32(a, b);
+  }
+  static inline vec mullo16(const vec a, const vec b) {
+    return _mm256_mullo_epi16(a, b);
+  }
+  static inline vec mulhi_epu16(const vec a, const vec b) {
+    return _mm256_mulhi_epu16(a, b);
+  }
+  static inline vec madd(const vec a, const vec b) {
+    return _mm256_madd_epi16(a, b);
+  }
+  static inline vec bitwise_xor(const vec a, const vec b) {
+    return _mm256_xor_si256(a, b);
+  }
+
+  template <int n>
+  static inline vec slli16(const vec a) {
+    return _mm256_slli_epi16(a, n);
+  }
+  template <int n>
+  static inline vec srai16(const vec a) {
+    return _mm256_srai_epi16(a, n);
+  }
+  template <int n>
+  static inline vec srai32(const vec a) {
+    return _mm256_srai_epi32(a, n);
+  }
+
+  static inline vec packs16(const vec a, const vec b) {
+    return _mm256_packs_epi16(a, b);
+  }
+  static inline vec packs32(const vec a, const vec b) {
+    return _mm256_packs_epi32(a, b);
+  }
+
+  static inline vec unpacklo16(const vec a, const vec b) {
+    return _mm256_unpacklo_epi16(a, b);
+  }
+  static inline vec unpackhi16(const vec a, const vec b) {
+    return _mm256_unpackhi_epi16(a, b);
+  }
+  static inline vec unpacklo32(const vec a, const vec b) {
+    return _mm256_unpacklo_epi32(a, b);
+  }
+  static inline vec unpackhi32(const vec a, const vec b) {
+    return _mm256_unpackhi_epi32(a, b);
+  }
+  static inline vec unpacklo64(const vec a, const vec b) {
+    return _mm256_unpacklo_epi64(a, b);
+  }
+  static inline vec unpackhi64(const vec a, const vec b) {
+    return _mm256_unpackhi_epi64(a, b);
+  }
+};
+}  // namespace
+
+#include "fastdct_simd_impl.hh"
+
+void codec::fastdct_simd::fdct_quantize_plane_avx2(const int16_t *plane,
+                                                   const size_t stride,
+                                                   const int16_t *divisors,
+                                                   int16_t *coefs) {
+  fdct_quantize_plane<AVX2>(plane, stride, divisors, coefs);
+}
+
+void codec::fastdct_simd::idct_islow_avx2(const int16_t *dct_table,
+                                          const int16_t *coef_block,
+                                          uint8_t **output_buf,
+                                          unsigned int output_col) {
+  idct_islow<AVX2>(dct_table, coef_block, output_buf, output_col);
+}
+
+#pragma GCC pop_options
@@ -0,0 +1,182 @@
+#include <immintrin.h>
+#include <cstdint>
+
+#include "fastdct_simd.hh"
+
+// everything below (including the kernel templates) is compiled for
+// AVX-512, whatever the rest of the build targets
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+
+// gcc 12's AVX-512 headers use a self-initialized "undefined" vector as
+// the pass-through operand of the unmasked extract, broadcast, 32-bit shift
+// and unpack intrinsics, which -Wuninitialized flags (gcc bug 105593). only
+// the wrappers around those intrinsics silence it
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12
+#define UNDEFINED_PASSTHROUGH_BEGIN \
+  _Pragma("GCC diagnostic push")    \
+      _Pragma("GCC diagnostic ignored \"-Wuninitialized\"")
+#define UNDEFINED_PASSTHROUGH_END _Pragma("GCC diagnostic pop")
+#else
+#define UNDEFINED_PASSTHROUGH_BEGIN
+#define UNDEFINED_PASSTHROUGH_END
+#endif
+
+namespace {
+// four blocks, one in each 128-bit lane
+struct AVX512 {
+  typedef __m512i vec;
+  static constexpr int blocks = 4;
+
+  // a row of the first block and the same row of the next three
+  // blocks, each of which starts `block_stride` elements later
+  static inline vec load_rows(const int16_t *row, const size_t block_stride) {
+    vec value = _mm512_castsi128_si512(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row)));
+    value = _mm512_inserti32x4(
+        value,
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + block_stride)),
+        1);
+    value = _mm512_inserti32x4(
+        value,
+        _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(row + 2 * block_stride)),
+        2);
+    value = _mm512_inserti32x4(
+        value,
+        _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(row + 3 * block_stride)),
+        3);
+    return value;
+  }
+
+  UNDEFINED_PASSTHROUGH_BEGIN
+  static inline void store_rows(int16_t *row, const size_t block_stride,
+                                const vec value) {
+    const __m128i lanes[4] = {_mm512_castsi512_si128(value),
+                              _mm512_extracti32x4_epi32(value, 1),
+                              _mm512_extracti32x4_epi32(value, 2),
+                              _mm512_extracti32x4_epi32(value, 3)};
+    for (int block = 0; block < blocks; block++) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(row + block * block_stride),
+                       lanes[block]);
+    }
+  }
+
+  static inline vec broadcast_row(const int16_t *row) {
+    return _mm512_broadcast_i32x4(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row)));
+  }
+
+  // the low and high 8 bytes of each lane go to `first` and `second`
+  static inline void store_row_pair(const vec value, uint8_t *first,
+                                    uint8_t *second) {
+    const __m128i lanes[4] = {_mm512_castsi512_si128(value),
+                              _mm512_extracti32x4_epi32(value, 1),
+                              _mm512_extracti32x4_epi32(value, 2),
+                              _mm512_extracti32x4_epi32(value, 3)};
+    for (int block = 0; block < blocks; block++) {
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(first + 8 * block),
+                       lanes[block]);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(second + 8 * block),
+                       _mm_unpackhi_epi64(lanes[block], lanes[block]));
+    }
+  }
+
+  UNDEFINED_PASSTHROUGH_END
+
+  static inline vec zero() { return _mm512_setzero_si512(); }
+  static inline vec set1_8(const char x) { return _mm512_set1_epi8(x); }
+  static inline vec set1_16(const int16_t x) { return _mm512_set1_epi16(x); }
+  static inline vec set1_32(const int32_t x) { return _mm512_set1_epi32(x); }
+
+  static inline vec add16(const vec a, const vec b) {
+    return _mm512_add_epi16(a, b);
+  }
+  static inline vec sub16(const vec a, const vec b) {
+    return _mm512_sub_epi16(a, b);
+  }
+  static inline vec add32(const vec a, const vec b) {
+    return _mm512_add_epi32(a, b);
+  }
+  static inline vec sub32(const vec a, const vec b) {
+    return _mm512_sub_epi32(a, b);
+  }
+  static inline vec mullo16(const vec a, const vec b) {
+    return _mm512_mullo_epi16(a, b);
+  }
+  static inline vec mulhi_epu16(const vec a, const vec b) {
+    return _mm512_mulhi_epu16(a, b);
+  }
+  static inline vec madd(const vec a, const vec b) {
+    return _mm512_madd_epi16(a, b);
+  }
+  static inline vec bitwise_xor(const vec a, const vec b) {
+    return _mm512_xor_si512(a, b);
+  }
+
+  template <int n>
+  static inline vec slli16(const vec a) {
+    return _mm512_slli_epi16(a, n);
+  }
+  template <int n>
+  static inline vec srai16(const vec a) {
+    return _mm512_srai_epi16(a, n);
+  }
+  UNDEFINED_PASSTHROUGH_BEGIN
+  template <int n>
+  static inline vec srai32(const vec a) {
+    return _mm512_srai_epi32(a, n);
+  }
+  UNDEFINED_PASSTHROUGH_END
+
+  static inline vec packs16(const vec a, const vec b) {
+    return _mm512_packs_epi16(a, b);
+  }
+  static inline vec packs32(const vec a, const vec b) {
+    return _mm512_packs_epi32(a, b);
+  }
+
+  static inline vec unpacklo16(const vec a, const vec b) {
+    return _mm512_unpacklo_epi16(a, b);
+  }
+  static inline vec unpackhi16(const vec a, const vec b) {
+    return _mm512_unpackhi_epi16(a, b);
+  }
+
+  UNDEFINED_PASSTHROUGH_BEGIN
+  static inline vec unpacklo32(const vec a, const vec b) {
+    return _mm512_unpacklo_epi32(a, b);
+  }
+  static inline vec unpackhi32(const vec a, const vec b) {
+    return _mm512_unpackhi_epi32(a, b);
+  }
+  static inline vec unpacklo64(const vec a, const vec b) {
+    return _mm512_unpacklo_epi64(a, b);
+  }
+  static inline vec unpackhi64(const vec a, const vec b) {
+    return _mm512_unpackhi_epi64(a, b);
+  }
+  UNDEFINED_PASSTHROUGH_END
+};
+}  // namespace
+
+#include "fastdct_simd_impl.hh"
+
+void codec::fastdct_simd::fdct_quantize_plane_avx512(const int16_t *plane,
+                                                     const size_t stride,
+                                                     const int16_t *divisors,
+                                                     int16_t *coefs) {
+  fdct_quantize_plane<AVX512>(plane, stride, divisors, coefs);
+}
+
+void codec::fastdct_simd::idct_islow_avx512(const int16_t *dct_table,
+                                            const int16_t *coef_block,
+                                            uint8_t **output_buf,
+                                            unsigned int output_col) {
+  idct_islow<AVX512>(dct_table, coef_block, output_buf, output_col);
+}
+
+#undef UNDEFINED_PASSTHROUGH_BEGIN
+#undef UNDEFINED_PASSTHROUGH_END
+#pragma GCC pop_options
@@ -0,0 +1,32 @@
+#ifndef _CODEC_FASTDCT_SIMD_HH
+#define _CODEC_FASTDCT_SIMD_HH
+
+#include <cstddef>
+#include <cstdint>
+
+// AVX2 and AVX-512 counterparts of the SSE2 islow kernels in tjdct/.
+// They transform 2 (AVX2) or 4 (AVX-512) horizontally adjacent 8x8
+// blocks per call. Only call them if the CPU supports the instruction
+// set (see codec::best_dct_kernel).
+namespace codec {
+namespace fastdct_simd {
+// Level shifts, transforms and quantizes (jsimd_fdct_islow_sse2 followed
+// by jsimd_quantize_sse2) the blocks of [0, 255] samples whose top left
+// corner is at `plane`; their rows are `stride` elements apart. The 64
+// coefficients of every block are written to `coefs`, back to back.
+void fdct_quantize_plane_avx2(const int16_t *plane, const size_t stride,
+                              const int16_t *divisors, int16_t *coefs);
+void fdct_quantize_plane_avx512(const int16_t *plane, const size_t stride,
+                                const int16_t *divisors, int16_t *coefs);
+
+// Same as jsimd_idct_islow_sse2, for the blocks whose coefficients are
+// stored back to back in `coef_block`. They are written next to each
+// other, starting at `output_col`.
+void idct_islow_avx2(const int16_t *dct_table, const int16_t *coef_block,
+                     uint8_t **output_buf, unsigned int output_col);
+void idct_islow_avx512(const int16_t *dct_table, const int16_t *coef_block,
+                       uint8_t **output_buf, unsigned int output_col);
+}  // namespace fastdct_simd
+}  // namespace codec
+
+#endif  // _CODEC_FASTDCT_SIMD_HH
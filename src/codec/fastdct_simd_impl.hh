@@ -0,0 +1,286 @@
+#ifndef _CODEC_FASTDCT_SIMD_IMPL_HH
+#define _CODEC_FASTDCT_SIMD_IMPL_HH
+
+// Vector-width agnostic versions of libjpeg-turbo's islow forward DCT,
+// quantizer and inverse DCT. `V` wraps one instruction set; every
+// 128-bit lane of a `V::vec` holds a row of a different 8x8 block, so a
+// call transforms `V::blocks` blocks. All of the arithmetic is lane
+// local and matches the SSE2 assembly in tjdct/ bit for bit.
+//
+// This file is only included by the per instruction set translation
+// units, after they have switched on their target with
+// `#pragma GCC target`, so that these templates are compiled for it.
+
+namespace codec {
+namespace fastdct_simd {
+namespace islow {
+static constexpr int CONST_BITS = 13;
+static constexpr int PASS1_BITS = 2;
+
+static constexpr int F_0_298 = 2446;
+static constexpr int F_0_390 = 3196;
+static constexpr int F_0_541 = 4433;
+static constexpr int F_0_765 = 6270;
+static constexpr int F_0_899 = 7373;
+static constexpr int F_1_175 = 9633;
+static constexpr int F_1_501 = 12299;
+static constexpr int F_1_847 = 15137;
+static constexpr int F_1_961 = 16069;
+static constexpr int F_2_053 = 16819;
+static constexpr int F_2_562 = 20995;
+static constexpr int F_3_072 = 25172;
+}  // namespace islow
+
+// 32-bit products of the low and high halves of a vector of 16-bit lanes
+template <class V>
+struct Wide {
+  typename V::vec lo;
+  typename V::vec hi;
+};
+
+template <class V>
+inline Wide<V> operator+(const Wide<V> a, const Wide<V> b) {
+  return {V::add32(a.lo, b.lo), V::add32(a.hi, b.hi)};
+}
+
+template <class V>
+inline Wide<V> operator-(const Wide<V> a, const Wide<V> b) {
+  return {V::sub32(a.lo, b.lo), V::sub32(a.hi, b.hi)};
+}
+
+// a * ca + b * cb, in 32 bits
+template <class V>
+inline Wide<V> multiply(const typename V::vec a, const typename V::vec b,
+                        const int16_t ca, const int16_t cb) {
+  const typename V::vec constants = V::set1_32(
+      static_cast<int32_t>((static_cast<uint32_t>(static_cast<uint16_t>(cb))
+                            << 16) |
+                           static_cast<uint16_t>(ca)));
+  return {V::madd(V::unpacklo16(a, b), constants),
+          V::madd(V::unpackhi16(a, b), constants)};
+}
+
+// a << CONST_BITS, in 32 bits
+template <class V>
+inline Wide<V> widen(const typename V::vec a) {
+  const typename V::vec zero = V::zero();
+  return {V::template srai32<16 - islow::CONST_BITS>(V::unpacklo16(zero, a)),
+          V::template srai32<16 - islow::CONST_BITS>(V::unpackhi16(zero, a))};
+}
+
+// rounding right shift back to 16 bits
+template <int n, class V>
+inline typename V::vec descale(const Wide<V> a) {
+  const typename V::vec round = V::set1_32(1 << (n - 1));
+  return V::packs32(V::template srai32<n>(V::add32(a.lo, round)),
+                    V::template srai32<n>(V::add32(a.hi, round)));
+}
+
+// transposes the 8x8 block in every lane
+template <class V>
+inline void transpose(typename V::vec rows[8]) {
+  typedef typename V::vec vec;
+
+  const vec a0 = V::unpacklo16(rows[0], rows[1]);
+  const vec a1 = V::unpackhi16(rows[0], rows[1]);
+  const vec a2 = V::unpacklo16(rows[2], rows[3]);
+  const vec a3 = V::unpackhi16(rows[2], rows[3]);
+  const vec a4 = V::unpacklo16(rows[4], rows[5]);
+  const vec a5 = V::unpackhi16(rows[4], rows[5]);
+  const vec a6 = V::unpacklo16(rows[6], rows[7]);
+  const vec a7 = V::unpackhi16(rows[6], rows[7]);
+
+  const vec b0 = V::unpacklo32(a0, a2);
+  const vec b1 = V::unpackhi32(a0, a2);
+  const vec b2 = V::unpacklo32(a1, a3);
+  const vec b3 = V::unpackhi32(a1, a3);
+  const vec b4 = V::unpacklo32(a4, a6);
+  const vec b5 = V::unpackhi32(a4, a6);
+  const vec b6 = V::unpacklo32(a5, a7);
+  const vec b7 = V::unpackhi32(a5, a7);
+
+  rows[0] = V::unpacklo64(b0, b4);
+  rows[1] = V::unpackhi64(b0, b4);
+  rows[2] = V::unpacklo64(b1, b5);
+  rows[3] = V::unpackhi64(b1, b5);
+  rows[4] = V::unpacklo64(b2, b6);
+  rows[5] = V::unpackhi64(b2, b6);
+  rows[6] = V::unpacklo64(b3, b7);
+  rows[7] = V::unpackhi64(b3, b7);
+}
+
+// One 1-D pass of the forward DCT: lane k of `d[i]` holds the i-th
+// input of the k-th transform and receives its i-th output.
+template <class V, bool first_pass>
+inline void fdct_pass(typename V::vec d[8]) {
+  using namespace islow;
+  typedef typename V::vec vec;
+  static constexpr int shift =
+      first_pass ? CONST_BITS - PASS1_BITS : CONST_BITS + PASS1_BITS;
+
+  const vec tmp0 = V::add16(d[0], d[7]);
+  const vec tmp7 = V::sub16(d[0], d[7]);
+  const vec tmp1 = V::add16(d[1], d[6]);
+  const vec tmp6 = V::sub16(d[1], d[6]);
+  const vec tmp2 = V::add16(d[2], d[5]);
+  const vec tmp5 = V::sub16(d[2], d[5]);
+  const vec tmp3 = V::add16(d[3], d[4]);
+  const vec tmp4 = V::sub16(d[3], d[4]);
+
+  // even part
+  const vec tmp10 = V::add16(tmp0, tmp3);
+  const vec tmp13 = V::sub16(tmp0, tmp3);
+  const vec tmp11 = V::add16(tmp1, tmp2);
+  const vec tmp12 = V::sub16(tmp1, tmp2);
+
+  if (first_pass) {
+    d[0] = V::template slli16<PASS1_BITS>(V::add16(tmp10, tmp11));
+    d[4] = V::template slli16<PASS1_BITS>(V::sub16(tmp10, tmp11));
+  } else {
+    const vec round = V::set1_16(1 << (PASS1_BITS - 1));
+    d[0] = V::template srai16<PASS1_BITS>(
+        V::add16(V::add16(tmp10, tmp11), round));
+    d[4] = V::template srai16<PASS1_BITS>(
+        V::add16(V::sub16(tmp10, tmp11), round));
+  }
+
+  d[2] = descale<shift>(multiply<V>(tmp13, tmp12, F_0_541 + F_0_765, F_0_541));
+  d[6] = descale<shift>(multiply<V>(tmp13, tmp12, F_0_541, F_0_541 - F_1_847));
+
+  // odd part
+  const vec z3 = V::add16(tmp4, tmp6);
+  const vec z4 = V::add16(tmp5, tmp7);
+
+  const Wide<V> z3_rotated = multiply<V>(z3, z4, F_1_175 - F_1_961, F_1_175);
+  const Wide<V> z4_rotated = multiply<V>(z3, z4, F_1_175, F_1_175 - F_0_390);
+
+  d[7] = descale<shift>(multiply<V>(tmp4, tmp7, F_0_298 - F_0_899, -F_0_899) +
+                        z3_rotated);
+  d[1] = descale<shift>(multiply<V>(tmp4, tmp7, -F_0_899, F_1_501 - F_0_899) +
+                        z4_rotated);
+  d[5] = descale<shift>(multiply<V>(tmp5, tmp6, F_2_053 - F_2_562, -F_2_562) +
+                        z4_rotated);
+  d[3] = descale<shift>(multiply<V>(tmp5, tmp6, -F_2_562, F_3_072 - F_2_562) +
+                        z3_rotated);
+}
+
+// One 1-D pass of the inverse DCT, laid out like fdct_pass.
+template <class V, int shift>
+inline void idct_pass(typename V::vec d[8]) {
+  using namespace islow;
+  typedef typename V::vec vec;
+
+  // even part
+  const Wide<V> tmp3 = multiply<V>(d[2], d[6], F_0_541 + F_0_765, F_0_541);
+  const Wide<V> tmp2 = multiply<V>(d[2], d[6], F_0_541, F_0_541 - F_1_847);
+
+  const Wide<V> tmp0 = widen<V>(V::add16(d[0], d[4]));
+  const Wide<V> tmp1 = widen<V>(V::sub16(d[0], d[4]));
+
+  const Wide<V> tmp10 = tmp0 + tmp3;
+  const Wide<V> tmp13 = tmp0 - tmp3;
+  const Wide<V> tmp11 = tmp1 + tmp2;
+  const Wide<V> tmp12 = tmp1 - tmp2;
+
+  // odd part
+  const vec z3 = V::add16(d[7], d[3]);
+  const vec z4 = V::add16(d[5], d[1]);
+
+  const Wide<V> z3_rotated = multiply<V>(z3, z4, F_1_175 - F_1_961, F_1_175);
+  const Wide<V> z4_rotated = multiply<V>(z3, z4, F_1_175, F_1_175 - F_0_390);
+
+  const Wide<V> odd0 =
+      multiply<V>(d[7], d[1], F_0_298 - F_0_899, -F_0_899) + z3_rotated;
+  const Wide<V> odd3 =
+      multiply<V>(d[7], d[1], -F_0_899, F_1_501 - F_0_899) + z4_rotated;
+  const Wide<V> odd1 =
+      multiply<V>(d[5], d[3], F_2_053 - F_2_562, -F_2_562) + z4_rotated;
+  const Wide<V> odd2 =
+      multiply<V>(d[5], d[3], -F_2_562, F_3_072 - F_2_562) + z3_rotated;
+
+  d[0] = descale<shift>(tmp10 + odd3);
+  d[7] = descale<shift>(tmp10 - odd3);
+  d[1] = descale<shift>(tmp11 + odd2);
+  d[6] = descale<shift>(tmp11 - odd2);
+  d[2] = descale<shift>(tmp12 + odd1);
+  d[5] = descale<shift>(tmp12 - odd1);
+  d[3] = descale<shift>(tmp13 + odd0);
+  d[4] = descale<shift>(tmp13 - odd0);
+}
+
+// jsimd_quantize_sse2 on one row of every block
+template <class V>
+inline typename V::vec quantize_row(const typename V::vec value,
+                                    const int16_t *divisors, const int row) {
+  typedef typename V::vec vec;
+
+  const vec reciprocal = V::broadcast_row(divisors + 8 * row);
+  const vec correction = V::broadcast_row(divisors + 64 + 8 * row);
+  const vec scale = V::broadcast_row(divisors + 128 + 8 * row);
+
+  const vec sign = V::template srai16<15>(value);
+
+  vec magnitude = V::sub16(V::bitwise_xor(value, sign), sign);
+  magnitude = V::add16(magnitude, correction);
+  magnitude = V::mulhi_epu16(magnitude, reciprocal);
+  magnitude = V::mulhi_epu16(magnitude, scale);
+
+  return V::sub16(V::bitwise_xor(magnitude, sign), sign);
+}
+
+// Level shift, jsimd_fdct_islow_sse2 and jsimd_quantize_sse2 in one go,
+// reading V::blocks adjacent blocks straight from a plane of samples and
+// keeping everything in registers until the coefficients are stored.
+template <class V>
+inline void fdct_quantize_plane(const int16_t *plane, const size_t stride,
+                                const int16_t *divisors, int16_t *coefs) {
+  typename V::vec d[8];
+  const typename V::vec center = V::set1_16(128);
+  for (int row = 0; row < 8; row++) {
+    d[row] = V::sub16(V::load_rows(plane + row * stride, 8), center);
+  }
+
+  // rows first, then columns
+  transpose<V>(d);
+  fdct_pass<V, true>(d);
+  transpose<V>(d);
+  fdct_pass<V, false>(d);
+
+  for (int row = 0; row < 8; row++) {
+    V::store_rows(coefs + 8 * row, 64, quantize_row<V>(d[row], divisors, row));
+  }
+}
+
+// same interface as jsimd_idct_islow_sse2, for V::blocks blocks that
+// are written next to each other starting at `output_col`
+template <class V>
+inline void idct_islow(const int16_t *dct_table, const int16_t *coef_block,
+                       uint8_t **output_buf, const unsigned int output_col) {
+  using namespace islow;
+  typedef typename V::vec vec;
+
+  vec d[8];
+  for (int row = 0; row < 8; row++) {
+    d[row] = V::mullo16(V::load_rows(coef_block + 8 * row, 64),
+                        V::broadcast_row(dct_table + 8 * row));
+  }
+
+  // columns first, then rows
+  idct_pass<V, CONST_BITS - PASS1_BITS>(d);
+  transpose<V>(d);
+  idct_pass<V, CONST_BITS + PASS1_BITS + 3>(d);
+  transpose<V>(d);
+
+  // saturate to a signed byte and undo the level shift
+  const vec center = V::set1_8(static_cast<char>(0x80));
+  for (int row = 0; row < 8; row += 2) {
+    const vec pixels =
+        V::bitwise_xor(V::packs16(d[row], d[row + 1]), center);
+    V::store_row_pair(pixels, output_buf[row] + output_col,
+                      output_buf[row + 1] + output_col);
+  }
+}
+}  // namespace fastdct_simd
+}  // namespace codec
+
+#endif  // _CODEC_FASTDCT_SIMD_IMPL_HH
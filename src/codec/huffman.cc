@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "huffman.hh"
+
+using namespace std;
+
+// depth of every leaf of the Huffman tree for `counts` (0 for symbols
+// that never occur)
+static vector<uint8_t> huffman_depths(const vector<uint64_t> &counts) {
+  const size_t num_symbols = counts.size();
+  vector<uint8_t> depths(num_symbols, 0);
+
+  // nodes [0, num_symbols) are leaves, the rest are internal nodes
+  vector<size_t> parent;
+  parent.reserve(2 * num_symbols);
+
+  // (count, node), ties broken by node index to stay deterministic
+  typedef pair<uint64_t, size_t> HeapItem;
+  priority_queue<HeapItem, vector<HeapItem>, greater<HeapItem>> heap;
+
+  for (size_t symbol = 0; symbol < num_symbols; symbol++) {
+    parent.push_back(0);
+    if (counts[symbol] > 0) {
+      heap.push({counts[symbol], symbol});
+    }
+  }
+
+  if (heap.empty()) {
+    return depths;
+  }
+  if (heap.size() == 1) {
+    depths[heap.top().second] = 1;
+    return depths;
+  }
+
+  while (heap.size() > 1) {
+    const HeapItem first = heap.top();
+    heap.pop();
+    const HeapItem second = heap.top();
+    heap.pop();
+
+    const size_t node = parent.size();
+    parent.push_back(0);
+    parent[first.second] = node;
+    parent[second.second] = node;
+
+    heap.push({first.first + second.first, node});
+  }
+
+  // internal nodes are created after their children, so walking down
+  // from the root in reverse creation order sees every parent first
+  vector<uint32_t> node_depths(parent.size(), 0);
+  for (size_t node = parent.size() - 1; node-- > 0;) {
+    node_depths[node] = node_depths[parent[node]] + 1;
+  }
+
+  for (size_t symbol = 0; symbol < num_symbols; symbol++) {
+    if (counts[symbol] > 0) {
+      depths[symbol] = min<uint32_t>(node_depths[symbol], 0xff);
+    }
+  }
+
+  return depths;
+}
+
+vector<uint8_t> codec::huffman_code_lengths(const vector<uint64_t> &counts) {
+  vector<uint64_t> scaled_counts(counts);
+
+  while (true) {
+    vector<uint8_t> lengths = huffman_depths(scaled_counts);
+    if (lengths.empty() or *max_element(lengths.begin(), lengths.end()) <=
+                               huffman::max_code_length) {
+      return lengths;
+    }
+
+    // flatten the distribution until the longest code fits
+    for (uint64_t &count : scaled_counts) {
+      if (count > 0) {
+        count = (count + 1) / 2;
+      }
+    }
+  }
+}
+
+void codec::write_huffman_code_lengths(vector<char> &output,
+                                       const vector<uint8_t> &lengths) {
+  for (size_t i = 0; i < lengths.size(); i += 2) {
+    const uint8_t low = lengths[i];
+    const uint8_t high = i + 1 < lengths.size() ? lengths[i + 1] : 0;
+    assert(low <= huffman::max_code_length);
+    assert(high <= huffman::max_code_length);
+
+    output.push_back(static_cast<char>(low | (high << 4)));
+  }
+}
+
+vector<uint8_t> codec::read_huffman_code_lengths(const vector<char> &input,
+                                                 size_t &offset,
+                                                 const uint32_t num_symbols) {
+  const size_t num_bytes = (num_symbols + 1) / 2;
+  if (offset + num_bytes > input.size()) {
+    throw runtime_error("huffman code lengths are truncated");
+  }
+
+  vector<uint8_t> lengths(num_symbols);
+  for (uint32_t i = 0; i < num_symbols; i++) {
+    const uint8_t byte = static_cast<uint8_t>(input[offset + i / 2]);
+    lengths[i] = i % 2 == 0 ? byte & 0xf : byte >> 4;
+  }
+  offset += num_bytes;
+
+  return lengths;
+}
+
+codec::HuffmanTable::HuffmanTable(const vector<uint8_t> &lengths)
+    : lengths_(lengths),
+      codes_(lengths.size(), 0),
+      sorted_symbols_(),
+      first_code_(),
+      first_index_(),
+      length_count_(),
+      lookup_(1 << huffman::lookup_bits) {
+  if (lengths_.size() > 0xffff + 1) {
+    throw runtime_error("too many symbols for a huffman table");
+  }
+
+  for (const uint8_t length : lengths_) {
+    if (length > huffman::max_code_length) {
+      throw runtime_error("huffman code length out of range");
+    }
+    length_count_[length]++;
+  }
+  length_count_[0] = 0;
+
+  // a set of lengths that does not form a prefix code cannot be decoded
+  uint64_t kraft_sum = 0;
+  for (uint32_t length = 1; length <= huffman::max_code_length; length++) {
+    kraft_sum += static_cast<uint64_t>(length_count_[length])
+                 << (huffman::max_code_length - length);
+  }
+  if (kraft_sum > (1u << huffman::max_code_length)) {
+    throw runtime_error("huffman code lengths are oversubscribed");
+  }
+
+  // assign canonical codes: shorter codes first, then by symbol
+  uint32_t code = 0;
+  uint32_t index = 0;
+  for (uint32_t length = 1; length <= huffman::max_code_length; length++) {
+    code = (code + length_count_[length - 1]) << 1;
+    first_code_[length] = code;
+    first_index_[length] = index;
+    index += length_count_[length];
+  }
+
+  sorted_symbols_.resize(index);
+  vector<uint32_t> next_code(first_code_,
+                             first_code_ + huffman::max_code_length + 1);
+  vector<uint32_t> next_index(first_index_,
+                              first_index_ + huffman::max_code_length + 1);
+  for (uint32_t symbol = 0; symbol < lengths_.size(); symbol++) {
+    const uint8_t length = lengths_[symbol];
+    if (length > 0) {
+      codes_[symbol] = next_code[length]++;
+      sorted_symbols_[next_index[length]++] = symbol;
+    }
+  }
+
+  // resolve as many codes as fit into every possible lookup window
+  for (uint32_t bits = 0; bits < lookup_.size(); bits++) {
+    LookupEntry &entry = lookup_[bits];
+    entry.num_symbols = 0;
+    entry.num_bits = 0;
+
+    uint32_t remaining = huffman::lookup_bits;
+    while (entry.num_symbols < huffman::max_lookup_symbols and remaining > 0) {
+      const uint32_t window = bits & ((1u << remaining) - 1);
+      const pair<uint32_t, uint32_t> symbol = decode(window, remaining);
+      if (symbol.second == 0) {
+        break;
+      }
+
+      entry.symbols[entry.num_symbols++] = symbol.first;
+      entry.num_bits += symbol.second;
+      remaining -= symbol.second;
+    }
+  }
+}
+
+pair<uint32_t, uint32_t> codec::HuffmanTable::decode(
+    const uint32_t window, const uint32_t window_bits) const {
+  const uint32_t max_length = min(window_bits, huffman::max_code_length);
+
+  for (uint32_t length = 1; length <= max_length; length++) {
+    const uint32_t code = window >> (window_bits - length);
+    const uint32_t offset = code - first_code_[length];
+    if (code >= first_code_[length] and offset < length_count_[length]) {
+      return {sorted_symbols_[first_index_[length] + offset], length};
+    }
+  }
+
+  // no code of at most `window_bits` bits matches
+  if (window_bits >= huffman::max_code_length) {
+    throw runtime_error("invalid huffman code");
+  }
+  return {0, 0};
+}
@@ -0,0 +1,209 @@
+#ifndef _CODEC_HUFFMAN_HH
+#define _CODEC_HUFFMAN_HH
+
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// constants (trying to avoid polluting the `codec` namespace)
+namespace codec {
+namespace huffman {
+// code lengths fit in a nibble when serialized
+static constexpr uint32_t max_code_length = 15;
+
+// the decoder resolves up to `max_lookup_symbols` codes that fit in the
+// next `lookup_bits` bits with a single table lookup
+static constexpr uint32_t lookup_bits = 11;
+static constexpr uint32_t max_lookup_symbols = 3;
+}  // namespace huffman
+
+// Length limited Huffman code lengths for a histogram. Symbols that
+// never occur get no code (a length of 0).
+std::vector<uint8_t> huffman_code_lengths(const std::vector<uint64_t> &counts);
+
+// Code lengths are serialized two per byte.
+void write_huffman_code_lengths(std::vector<char> &output,
+                                const std::vector<uint8_t> &lengths);
+std::vector<uint8_t> read_huffman_code_lengths(const std::vector<char> &input,
+                                               size_t &offset,
+                                               const uint32_t num_symbols);
+
+//////////////////////////////////////////////////////////////////////
+// Huffman Table
+//
+// Canonical Huffman code built from code lengths, so only the lengths
+// need to be stored or shared between encoder and decoder.
+//////////////////////////////////////////////////////////////////////
+class HuffmanTable {
+ public:
+  struct LookupEntry {
+    uint8_t num_symbols;  // 0 if the next code is longer than lookup_bits
+    uint8_t num_bits;
+    uint16_t symbols[huffman::max_lookup_symbols];
+  };
+
+ private:
+  std::vector<uint8_t> lengths_;
+  std::vector<uint32_t> codes_;
+
+  // canonical decoding state, indexed by code length
+  std::vector<uint16_t> sorted_symbols_;
+  uint32_t first_code_[huffman::max_code_length + 1];
+  uint32_t first_index_[huffman::max_code_length + 1];
+  uint32_t length_count_[huffman::max_code_length + 1];
+
+  std::vector<LookupEntry> lookup_;
+
+ public:
+  HuffmanTable(const std::vector<uint8_t> &lengths);
+  ~HuffmanTable() {}
+
+  inline uint32_t num_symbols() const { return lengths_.size(); }
+  inline const std::vector<uint8_t> &lengths() const { return lengths_; }
+
+  inline uint32_t code(const uint32_t symbol) const { return codes_[symbol]; }
+  inline uint32_t length(const uint32_t symbol) const {
+    return lengths_[symbol];
+  }
+
+  inline const LookupEntry &lookup(const uint32_t bits) const {
+    return lookup_[bits];
+  }
+
+  // Decodes the code at the top of the `window` bits. Returns the
+  // symbol and the length of its code.
+  std::pair<uint32_t, uint32_t> decode(const uint32_t window,
+                                       const uint32_t window_bits) const;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Huffman Encoder
+//////////////////////////////////////////////////////////////////////
+class HuffmanEncoder {
+ private:
+  const HuffmanTable &table_;
+  std::vector<char> data_;
+
+  uint64_t bit_buffer_;
+  uint32_t bit_count_;
+
+ public:
+  HuffmanEncoder(const HuffmanTable &table)
+      : table_(table), data_(), bit_buffer_(0), bit_count_(0) {}
+
+  ~HuffmanEncoder() {}
+
+  inline void encode_symbol(const uint32_t symbol) {
+    const uint32_t length = table_.length(symbol);
+    if (length == 0) {
+      throw std::runtime_error("symbol has no huffman code");
+    }
+
+    bit_buffer_ = (bit_buffer_ << length) | table_.code(symbol);
+    bit_count_ += length;
+
+    while (bit_count_ >= 8) {
+      bit_count_ -= 8;
+      data_.push_back(static_cast<char>(bit_buffer_ >> bit_count_));
+    }
+  }
+
+  std::vector<char> finish() {
+    // pad the last byte with zeros
+    if (bit_count_ > 0) {
+      data_.push_back(static_cast<char>(bit_buffer_ << (8 - bit_count_)));
+      bit_count_ = 0;
+    }
+
+    return data_;
+  }
+};
+
+//////////////////////////////////////////////////////////////////////
+// Huffman Decoder
+//
+// Every lookup into the table resolves all of the (up to
+// `huffman::max_lookup_symbols`) short codes in the next
+// `huffman::lookup_bits` bits. The extra symbols are buffered and handed
+// out by the following calls to `decode_symbol`.
+//////////////////////////////////////////////////////////////////////
+class HuffmanDecoder {
+ private:
+  const HuffmanTable &table_;
+  const std::vector<char> data_;
+  size_t byte_idx_;
+
+  // the next `bit_count_` bits of the stream, most significant first
+  uint64_t bit_buffer_;
+  uint32_t bit_count_;
+
+  uint16_t pending_[huffman::max_lookup_symbols];
+  uint32_t pending_count_;
+  uint32_t pending_idx_;
+
+  // reading past the end of the data yields zeros
+  inline void refill() {
+    while (bit_count_ <= 56) {
+      uint64_t byte = 0;
+      if (byte_idx_ < data_.size()) {
+        byte = static_cast<uint8_t>(data_[byte_idx_]);
+      }
+      byte_idx_++;
+
+      bit_buffer_ |= byte << (56 - bit_count_);
+      bit_count_ += 8;
+    }
+  }
+
+  inline void consume(const uint32_t num_bits) {
+    bit_buffer_ <<= num_bits;
+    bit_count_ -= num_bits;
+  }
+
+ public:
+  HuffmanDecoder(std::vector<char> data, const HuffmanTable &table)
+      : table_(table),
+        data_(data),
+        byte_idx_(0),
+        bit_buffer_(0),
+        bit_count_(0),
+        pending_(),
+        pending_count_(0),
+        pending_idx_(0) {}
+
+  ~HuffmanDecoder() {}
+
+  inline uint32_t decode_symbol() {
+    if (pending_idx_ < pending_count_) {
+      return pending_[pending_idx_++];
+    }
+
+    refill();
+
+    const HuffmanTable::LookupEntry &entry =
+        table_.lookup(bit_buffer_ >> (64 - huffman::lookup_bits));
+
+    if (entry.num_symbols > 0) {
+      consume(entry.num_bits);
+
+      for (uint32_t i = 1; i < entry.num_symbols; i++) {
+        pending_[i - 1] = entry.symbols[i];
+      }
+      pending_count_ = entry.num_symbols - 1;
+      pending_idx_ = 0;
+
+      return entry.symbols[0];
+    }
+
+    // the code is longer than a lookup
+    const auto symbol = table_.decode(
+        bit_buffer_ >> (64 - huffman::max_code_length), huffman::max_code_length);
+    consume(symbol.second);
+    return symbol.first;
+  }
+};
+}  // namespace codec
+
+#endif  // _CODEC_HUFFMAN_HH
@@ -1,40 +1,128 @@
 #include "jpeg.hh"
 
+#include <csetjmp>
+#include <cstdlib>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 
 extern "C" {
 #include <jpeglib.h>
 }
 #include <turbojpeg.h>
 
+#include "workspace.hh"
+
 using namespace std;
 
-vector<uint8_t> codec::JPEGEncoder::encode(vector<uint8_t>& image,
-                                           const size_t width,
-                                           const size_t height,
-                                           const size_t channels) {
-  if (channels != 1 and channels != 3) {
-    throw runtime_error("number of channels must be 1 or 3");
+namespace {
+// What a thread keeps around for compressing images (see
+// codec::thread_workspace).
+struct CompressionWorkspace {
+  // the libjpeg compressor, for the arithmetic and optimized Huffman
+  // coders, and its output buffer, which libjpeg grows as needed
+  jpeg_error_mgr error_manager;
+  jpeg_compress_struct context;
+  unsigned char *buffer;
+  unsigned long buffer_size;
+
+  // the turbojpeg compressor, and its output buffer, which is grown to
+  // tjBufSize before every image so it never needs reallocating
+  tjhandle tj_compressor;
+  unsigned char *tj_buffer;
+  unsigned long tj_buffer_size;
+
+  CompressionWorkspace()
+      : error_manager(),
+        context(),
+        buffer(nullptr),
+        buffer_size(0),
+        tj_compressor(tjInitCompress()),
+        tj_buffer(nullptr),
+        tj_buffer_size(0) {
+    if (tj_compressor == nullptr) {
+      throw runtime_error("could not create a turbojpeg compressor");
+    }
+
+    context.err = jpeg_std_error(&error_manager);
+    jpeg_create_compress(&context);
   }
 
-  if (image.size() != width * height * channels) {
-    throw runtime_error("image.size != width * height * channels");
+  ~CompressionWorkspace() {
+    jpeg_destroy_compress(&context);
+    free(buffer);
+    tjDestroy(tj_compressor);
+    tjFree(tj_buffer);
   }
 
-  jpeg_compress_struct context;
-  jpeg_error_mgr jerr;
+  CompressionWorkspace(const CompressionWorkspace &) = delete;
+  CompressionWorkspace &operator=(const CompressionWorkspace &) = delete;
+};
+
+// libjpeg reports fatal errors by calling error_exit, which must not
+// return. Ours jumps back to the decoder, which turns the error into an
+// exception; the default one would exit the process over a corrupt
+// input.
+struct ErrorManager {
+  jpeg_error_mgr manager;
+  jmp_buf error_jump;
+};
+
+void jump_on_error(j_common_ptr context) {
+  longjmp(reinterpret_cast<ErrorManager *>(context->err)->error_jump, 1);
+}
+
+// What a thread keeps around for decompressing images.
+struct DecompressionWorkspace {
+  ErrorManager error_manager;
+  jpeg_decompress_struct context;
+
+  // the scanlines of the last read
+  static constexpr int band_height = 8;
+  std::vector<uint8_t> band;
+
+  DecompressionWorkspace() : error_manager(), context(), band() {
+    context.err = jpeg_std_error(&error_manager.manager);
+    error_manager.manager.error_exit = jump_on_error;
+    jpeg_create_decompress(&context);
+  }
+
+  ~DecompressionWorkspace() { jpeg_destroy_decompress(&context); }
 
-  jpeg_create_compress(&context);
-  context.in_color_space = (channels == 1) ? JCS_GRAYSCALE : JCS_RGB;
+  DecompressionWorkspace(const DecompressionWorkspace &) = delete;
+  DecompressionWorkspace &operator=(const DecompressionWorkspace &) = delete;
+};
+}  // namespace
+
+// libjpeg's arithmetic or optimized Huffman coder
+static vector<uint8_t> libjpeg_encode(CompressionWorkspace &workspace,
+                                      const vector<uint8_t> &image,
+                                      const size_t width, const size_t height,
+                                      const J_COLOR_SPACE color_space,
+                                      const int quality,
+                                      const codec::JPEGEntropyCoder coder) {
+  jpeg_compress_struct &context = workspace.context;
+  const size_t channels = (color_space == JCS_GRAYSCALE) ? 1 : 3;
+
+  context.in_color_space = color_space;
   jpeg_set_defaults(&context);
-  jpeg_set_quality(&context, quality_, true);
-  context.arith_code = true;
-  context.err = jpeg_std_error(&jerr);
+  jpeg_set_quality(&context, quality, true);
+  context.arith_code = (coder == codec::JPEGEntropyCoder::ARITHMETIC);
+  context.optimize_coding =
+      (coder == codec::JPEGEntropyCoder::OPTIMIZED_HUFFMAN);
   context.dct_method = JDCT_FASTEST;
 
-  long unsigned int jpeg_size = 0;
-  unsigned char* compressed_image = nullptr;
+  // YCbCr input is taken as is (see JPEGEncoder::encode_ycc)
+  if (color_space == JCS_YCbCr) {
+    for (int component = 0; component < context.num_components; component++) {
+      jpeg_component_info &info = context.comp_info[component];
+      info.h_samp_factor = 1;
+      info.v_samp_factor = 1;
+      info.quant_tbl_no = 0;
+      info.dc_tbl_no = 0;
+      info.ac_tbl_no = 0;
+    }
+  }
 
   context.image_width = width;
   context.image_height = height;
@@ -42,18 +130,187 @@ vector<uint8_t> codec::JPEGEncoder::encode(vector<uint8_t>& image,
 
   const size_t row_stride = channels * width;
 
+  // libjpeg replaces the buffer with a bigger one (which becomes ours) if
+  // the image does not fit, and reports the size of the image rather than
+  // that of the buffer
+  unsigned char *compressed_image = workspace.buffer;
+  unsigned long jpeg_size = workspace.buffer_size;
+
   jpeg_mem_dest(&context, &compressed_image, &jpeg_size);
   jpeg_start_compress(&context, true);
 
   while (context.next_scanline < context.image_height) {
-    unsigned char* location = &image[context.next_scanline * row_stride];
+    // libjpeg only reads the scanlines, whatever their type says
+    unsigned char *location = const_cast<unsigned char *>(
+        &image[context.next_scanline * row_stride]);
     jpeg_write_scanlines(&context, &location, 1);
   }
 
   jpeg_finish_compress(&context);
-  jpeg_destroy_compress(&context);
 
-  vector<uint8_t> result{compressed_image, compressed_image + jpeg_size};
-  free(compressed_image);
-  return result;
+  if (compressed_image != workspace.buffer) {
+    free(workspace.buffer);
+    workspace.buffer = compressed_image;
+    workspace.buffer_size = jpeg_size;
+  }
+
+  return {compressed_image, compressed_image + jpeg_size};
+}
+
+// turbojpeg's Huffman coder with the standard tables
+static vector<uint8_t> turbojpeg_encode(CompressionWorkspace &workspace,
+                                        const vector<uint8_t> &image,
+                                        const size_t width,
+                                        const size_t height,
+                                        const size_t channels,
+                                        const int quality) {
+  // the same chroma subsampling libjpeg defaults to
+  const int subsampling = (channels == 1) ? TJSAMP_GRAY : TJSAMP_420;
+  const int pixel_format = (channels == 1) ? TJPF_GRAY : TJPF_RGB;
+
+  const unsigned long max_size = tjBufSize(width, height, subsampling);
+  if (workspace.tj_buffer_size < max_size) {
+    tjFree(workspace.tj_buffer);
+    workspace.tj_buffer = tjAlloc(max_size);
+    if (workspace.tj_buffer == nullptr) {
+      workspace.tj_buffer_size = 0;
+      throw runtime_error("could not allocate a turbojpeg buffer");
+    }
+    workspace.tj_buffer_size = max_size;
+  }
+
+  unsigned long jpeg_size = workspace.tj_buffer_size;
+  if (tjCompress2(workspace.tj_compressor, image.data(), width, 0 /*pitch*/,
+                  height, pixel_format, &workspace.tj_buffer, &jpeg_size,
+                  subsampling, quality,
+                  TJFLAG_FASTDCT | TJFLAG_NOREALLOC) != 0) {
+    throw runtime_error(string("turbojpeg compression failed: ") +
+                        tjGetErrorStr2(workspace.tj_compressor));
+  }
+
+  return {workspace.tj_buffer, workspace.tj_buffer + jpeg_size};
+}
+
+codec::JPEGEntropyCoder codec::jpeg_entropy_coder(const int entropy_coder) {
+  switch (entropy_coder) {
+    case static_cast<int>(JPEGEntropyCoder::ARITHMETIC):
+    case static_cast<int>(JPEGEntropyCoder::HUFFMAN):
+    case static_cast<int>(JPEGEntropyCoder::OPTIMIZED_HUFFMAN):
+      return static_cast<JPEGEntropyCoder>(entropy_coder);
+    default:
+      throw runtime_error("unknown jpeg entropy coder: " +
+                          to_string(entropy_coder));
+  }
+}
+
+vector<uint8_t> codec::JPEGEncoder::encode(const vector<uint8_t> &image,
+                                           const size_t width,
+                                           const size_t height,
+                                           const size_t channels) const {
+  if (channels != 1 and channels != 3) {
+    throw runtime_error("number of channels must be 1 or 3");
+  }
+
+  if (image.size() != width * height * channels) {
+    throw runtime_error("image.size != width * height * channels");
+  }
+
+  CompressionWorkspace &workspace = thread_workspace<CompressionWorkspace>();
+
+  if (entropy_coder_ == JPEGEntropyCoder::HUFFMAN) {
+    return turbojpeg_encode(workspace, image, width, height, channels,
+                            quality_);
+  }
+  return libjpeg_encode(workspace, image, width, height,
+                        (channels == 1) ? JCS_GRAYSCALE : JCS_RGB, quality_,
+                        entropy_coder_);
+}
+
+vector<uint8_t> codec::JPEGEncoder::encode_ycc(const vector<uint8_t> &image,
+                                               const size_t width,
+                                               const size_t height) const {
+  if (image.size() != width * height * 3) {
+    throw runtime_error("image.size != width * height * 3");
+  }
+
+  // turbojpeg always codes the chroma components with the chroma tables,
+  // so even the standard Huffman tables go through libjpeg here
+  return libjpeg_encode(thread_workspace<CompressionWorkspace>(), image, width,
+                        height, JCS_YCbCr, quality_, entropy_coder_);
+}
+
+// Runs the libjpeg calls of a decode, returning false if libjpeg gave up
+// on the image. Nothing in here may need destroying, since a libjpeg error
+// jumps straight back to the setjmp.
+static bool read_rows(
+    DecompressionWorkspace &workspace, const uint8_t *jpeg,
+    const size_t jpeg_size, const size_t width, const size_t height,
+    const size_t channels,
+    const std::function<void(const uint8_t *, size_t)> &consume_row) {
+  jpeg_decompress_struct &context = workspace.context;
+
+  if (setjmp(workspace.error_manager.error_jump)) {
+    jpeg_abort_decompress(&context);
+    return false;
+  }
+
+  jpeg_mem_src(&context, jpeg, jpeg_size);
+  jpeg_read_header(&context, true);
+
+  if (context.image_width != width or context.image_height != height or
+      static_cast<size_t>(context.num_components) != channels) {
+    throw runtime_error("jpeg image does not have the expected shape");
+  }
+
+  // YCbCr samples come out as they were coded
+  context.out_color_space = (channels == 1) ? JCS_GRAYSCALE : JCS_YCbCr;
+  context.dct_method = JDCT_FASTEST;
+  jpeg_start_decompress(&context);
+
+  JSAMPROW rows[DecompressionWorkspace::band_height];
+  for (int row = 0; row < DecompressionWorkspace::band_height; row++) {
+    rows[row] = &workspace.band[row * width * channels];
+  }
+
+  while (context.output_scanline < context.output_height) {
+    const size_t band_offset = context.output_scanline;
+    const JDIMENSION band_rows = jpeg_read_scanlines(
+        &context, rows, DecompressionWorkspace::band_height);
+
+    for (JDIMENSION row = 0; row < band_rows; row++) {
+      consume_row(rows[row], band_offset + row);
+    }
+  }
+
+  jpeg_finish_decompress(&context);
+  return true;
+}
+
+void codec::JPEGDecoder::decode_rows(
+    const uint8_t *jpeg, const size_t jpeg_size, const size_t width,
+    const size_t height, const size_t channels,
+    const std::function<void(const uint8_t *, size_t)> &consume_row) const {
+  if (channels != 1 and channels != 3) {
+    throw runtime_error("number of channels must be 1 or 3");
+  }
+
+  DecompressionWorkspace &workspace =
+      thread_workspace<DecompressionWorkspace>();
+
+  workspace.band.resize(DecompressionWorkspace::band_height * width *
+                        channels);
+
+  bool decoded;
+  try {
+    decoded = read_rows(workspace, jpeg, jpeg_size, width, height, channels,
+                        consume_row);
+  } catch (...) {
+    // leave the decompressor ready for the next image
+    jpeg_abort_decompress(&workspace.context);
+    throw;
+  }
+
+  if (not decoded) {
+    throw runtime_error("could not decompress the jpeg image");
+  }
 }
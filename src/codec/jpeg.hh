@@ -1,20 +1,66 @@
 #ifndef _CODEC_JPEG_HH
 #define _CODEC_JPEG_HH
 
+#include <functional>
 #include <vector>
 #include "nn/tensor.hh"
 
 namespace codec {
 
+// How the coefficients get entropy coded. ARITHMETIC (libjpeg's
+// arithmetic coder) gives the smallest images but is by far the slowest.
+// HUFFMAN goes through turbojpeg's SIMD Huffman coder with the standard
+// tables, and OPTIMIZED_HUFFMAN builds tables for every image at the cost
+// of a second pass over its coefficients.
+enum class JPEGEntropyCoder {
+  ARITHMETIC = 0,
+  HUFFMAN = 1,
+  OPTIMIZED_HUFFMAN = 2
+};
+
+// the entropy coder numbered `entropy_coder`, or an exception
+JPEGEntropyCoder jpeg_entropy_coder(const int entropy_coder);
+
+// Compresses images with compressor state (and output buffers) that is
+// set up once per thread and reused for every image after that, so an
+// encoder is safe to use from OpenMP threads.
 class JPEGEncoder {
  private:
   const int quality_;
+  const JPEGEntropyCoder entropy_coder_;
+
+ public:
+  JPEGEncoder(const int quality, const JPEGEntropyCoder entropy_coder =
+                                     JPEGEntropyCoder::ARITHMETIC)
+      : quality_(quality), entropy_coder_(entropy_coder) {}
+
+  std::vector<uint8_t> encode(const std::vector<uint8_t>& image,
+                              const size_t width, const size_t height,
+                              const size_t channels) const;
+
+  // Compresses an image of interleaved Y, Cb and Cr samples as they are:
+  // none of the components is subsampled, and all three get the luma
+  // tables so that they are coded with the same fidelity.
+  std::vector<uint8_t> encode_ycc(const std::vector<uint8_t>& image,
+                                  const size_t width,
+                                  const size_t height) const;
+};
 
+// Decompresses grayscale or YCbCr images a few scanlines at a time with
+// decompressor state that is set up once per thread, like JPEGEncoder.
+class JPEGDecoder {
  public:
-  JPEGEncoder(const int quality) : quality_(quality) {}
+  JPEGDecoder() {}
 
-  std::vector<uint8_t> encode(std::vector<uint8_t>& image, const size_t width,
-                              const size_t height, const size_t channels);
+  // Decompresses the `jpeg_size` bytes at `jpeg`, which must be a
+  // `width` x `height` image with `channels` components (1 for a
+  // grayscale image, 3 for one from encode_ycc), and hands its rows of
+  // interleaved samples to `consume_row(row, row_index)` from top to
+  // bottom. A row is only valid for the duration of the call.
+  void decode_rows(
+      const uint8_t* jpeg, const size_t jpeg_size, const size_t width,
+      const size_t height, const size_t channels,
+      const std::function<void(const uint8_t*, size_t)>& consume_row) const;
 };
 }  // namespace codec
 
@@ -5,8 +5,13 @@ extern "C" {
 #include <libavutil/opt.h>
 }
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <tuple>
+
+#include "workspace.hh"
 
 using namespace std;
 using namespace codec;
@@ -28,89 +33,178 @@ inline int CheckAVCommand(const char* s_attempt, const int return_value) {
   throw runtime_error(s_attempt);
 }
 
-template <AVCodecID codec_id>
-vector<uint8_t> MPEGEncoder<codec_id>::encode(const vector<uint8_t>& image,
-                                              const size_t width,
-                                              const size_t height,
-                                              const size_t channels) {
-  if (channels != 1 and channels != 3) {
-    throw runtime_error("number of channels must be 1 or 3");
-  }
-
-  if ((channels == 1 and image.size() < width * height) or
-      (channels == 3 and image.size() < width * height * 3 / 2)) {
-    throw runtime_error("unexpected image length");
-  }
+static void initialize_libav() {
+  static once_flag initialized;
+  call_once(initialized, [] {
+    av_log_set_level(AV_LOG_QUIET);
+    avcodec_register_all();
+  });
+}
 
-  /* Preparing the codec, the context and the frame */
-  av_log_set_level(AV_LOG_QUIET);
-  avcodec_register_all();
+// An open encoder, along with the frame and packet it codes through.
+// Opening one (x264 and x265 in particular) costs more than coding a
+// small frame, so they are kept around and reused for every image of the
+// same shape (see SessionPool).
+struct codec::MPEGEncoderSession {
+  shared_ptr<AVCodecContext> context{};
+  shared_ptr<AVFrame> frame{};
+  shared_ptr<AVPacket> packet{};
+  size_t width{0};
+  size_t height{0};
+
+  // the encoders want strictly increasing timestamps
+  int64_t next_pts{0};
+
+  // whether the chroma planes of the frame are blank, which only needs
+  // doing once for a run of grayscale images
+  bool blank_chroma{false};
+};
+
+// An open decoder, along with its parser and the frame it decodes into.
+struct codec::MPEGDecoderSession {
+  shared_ptr<AVCodecContext> context{};
+  shared_ptr<AVCodecParserContext> parser{};
+  shared_ptr<AVFrame> frame{};
+  size_t width{0};
+  size_t height{0};
+};
+
+namespace {
+
+// (codec, width, height, quantizer)
+typedef tuple<AVCodecID, size_t, size_t, int> EncoderKey;
+
+// (codec, width, height)
+typedef tuple<AVCodecID, size_t, size_t> DecoderKey;
+
+// The sessions of a thread (see codec::thread_workspace), so that no two
+// threads ever code through the same one. A thread that keeps seeing new
+// shapes starts over rather than hoarding sessions.
+struct SessionPool {
+  static constexpr size_t max_sessions = 8;
+
+  map<EncoderKey, MPEGEncoderSession> encoders{};
+  map<DecoderKey, MPEGDecoderSession> decoders{};
+};
+}  // namespace
+
+// An encoder that makes a keyframe every `gop_size` frames, or of every
+// frame for a `gop_size` of 0. Keyframes repeat the stream headers, so a
+// stream can be decoded from any of them.
+static MPEGEncoderSession open_encoder(const AVCodecID codec_id,
+                                       const AVPixelFormat pix_fmt,
+                                       const size_t width,
+                                       const size_t height,
+                                       const int quantizer,
+                                       const int gop_size) {
+  initialize_libav();
   AVCodec* encoder =
-      CheckAVCommand("find_encoder", avcodec_find_encoder(codec_id_));
+      CheckAVCommand("find_encoder", avcodec_find_encoder(codec_id));
 
-  shared_ptr<AVCodecContext> context{
+  MPEGEncoderSession session;
+  session.width = width;
+  session.height = height;
+  session.context = {
       CheckAVCommand("alloc_context", avcodec_alloc_context3(encoder)),
       [](auto* c) { avcodec_free_context(&c); }};
 
-  context->pix_fmt = pix_fmt_;
+  AVCodecContext* context = session.context.get();
+  context->pix_fmt = pix_fmt;
   context->width = width;
   context->height = height;
   context->bit_rate = 1 << 10;
   context->bit_rate_tolerance = 0;
   context->time_base = (AVRational){1, 20};
   context->framerate = (AVRational){60, 1};
-  context->gop_size = 0;
+  context->gop_size = gop_size;
   context->max_b_frames = 0;
-  context->qmin = quantizer_;
-  context->qmax = quantizer_;
+  context->qmin = quantizer;
+  context->qmax = quantizer;
   context->qcompress = 0.5;
   av_opt_set(context->priv_data, "tune", "zerolatency", 0);
   av_opt_set(context->priv_data, "preset", "fast", 0);
 
-  CheckAVCommand("avcodec_open2", avcodec_open2(context.get(), encoder, NULL));
+  // make the keyframes asked for with AV_PICTURE_TYPE_I IDR frames, so
+  // that nothing after them refers to anything before
+  av_opt_set_int(context->priv_data, "forced-idr", 1, 0);
 
-  shared_ptr<AVFrame> frame{CheckAVCommand("encoder_frame", av_frame_alloc()),
-                            [](auto* f) { av_frame_free(&f); }};
+  CheckAVCommand("avcodec_open2", avcodec_open2(context, encoder, NULL));
 
-  frame->width = width;
-  frame->height = height;
-  frame->format = pix_fmt_;
-  frame->pts = 0;
+  session.frame = {CheckAVCommand("encoder_frame", av_frame_alloc()),
+                   [](auto* f) { av_frame_free(&f); }};
 
-  shared_ptr<AVPacket> packet{
-      CheckAVCommand("encoder_frame", av_packet_alloc()),
-      [](auto* p) { av_packet_free(&p); }};
+  session.frame->width = width;
+  session.frame->height = height;
+  session.frame->format = pix_fmt;
 
-  CheckAVCommand("av_frame_get_buffer", av_frame_get_buffer(frame.get(), 32));
-  CheckAVCommand("av_frame_make_writable", av_frame_make_writable(frame.get()));
+  session.packet = {CheckAVCommand("encoder_frame", av_packet_alloc()),
+                    [](auto* p) { av_packet_free(&p); }};
 
-  for (size_t row = 0; row < height; row++) {
-    memcpy(frame->data[0] + frame->linesize[0] * row,
-           image.data() + width * row, width);
-  }
+  CheckAVCommand("av_frame_get_buffer",
+                 av_frame_get_buffer(session.frame.get(), 32));
 
-  if (channels == 1) {
-    memset(frame->data[1], 0, frame->linesize[1] * height / 2);
-    memset(frame->data[2], 0, frame->linesize[2] * height / 2);
-  } else {
-    for (size_t row = 0; row < height / 2; row++) {
-      memcpy(frame->data[1] + frame->linesize[1] * row,
-             image.data() + width * height + width * row / 2, width / 2);
+  return session;
+}
 
-      memcpy(frame->data[2] + frame->linesize[2] * row,
-             image.data() + 5 * width * height / 4 + width * row / 2,
-             width / 2);
-    }
+static MPEGDecoderSession open_decoder(const AVCodecID codec_id,
+                                       const AVPixelFormat pix_fmt,
+                                       const size_t width,
+                                       const size_t height) {
+  initialize_libav();
+  AVCodec* decoder =
+      CheckAVCommand("find_decoder", avcodec_find_decoder(codec_id));
+
+  MPEGDecoderSession session;
+  session.width = width;
+  session.height = height;
+  session.context = {
+      CheckAVCommand("alloc_context", avcodec_alloc_context3(decoder)),
+      [](auto* c) { avcodec_free_context(&c); }};
+
+  AVCodecContext* context = session.context.get();
+  context->pix_fmt = pix_fmt;
+  context->width = width;
+  context->height = height;
+  context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+  av_opt_set(context->priv_data, "tune", "zerolatency", 0);
+
+  session.parser = {
+      CheckAVCommand("av_parser_init", av_parser_init(decoder->id)),
+      [](auto* c) { av_parser_close(c); }};
+
+  session.parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+
+  CheckAVCommand("avcodec_open2", avcodec_open2(context, decoder, NULL));
+
+  session.frame = {CheckAVCommand("frame_alloc", av_frame_alloc()),
+                   [](auto* f) { av_frame_free(&f); }};
+
+  return session;
+}
+
+// the session for `key` in `sessions`, opened with `open` if there is
+// none yet
+template <class Key, class Session, class Open>
+static Session& find_session(map<Key, Session>& sessions, const Key& key,
+                             Open&& open) {
+  auto session = sessions.find(key);
+  if (session != sessions.end()) {
+    return session->second;
   }
 
-  vector<uint8_t> result;
-  int ret = CheckAVCommand("avcodec_send_frame",
-                           avcodec_send_frame(context.get(), frame.get()));
+  if (sessions.size() >= SessionPool::max_sessions) {
+    sessions.clear();
+  }
+  return sessions.emplace(key, open()).first->second;
+}
 
-  while (ret >= 0) {
-    ret = avcodec_receive_packet(context.get(), packet.get());
+// appends the packets `context` has ready to `result`
+static void receive_packets(AVCodecContext* context, AVPacket* packet,
+                            vector<uint8_t>& result) {
+  while (true) {
+    const int ret = avcodec_receive_packet(context, packet);
     if (ret == AVERROR(EAGAIN) or ret == AVERROR_EOF) {
-      break;
+      return;
     } else if (ret < 0) {
       throw runtime_error("receive_packet");
     }
@@ -118,87 +212,238 @@ vector<uint8_t> MPEGEncoder<codec_id>::encode(const vector<uint8_t>& image,
     size_t start_idx = result.size();
     result.resize(result.size() + packet->size);
     memcpy(result.data() + start_idx, packet->data, packet->size);
+    av_packet_unref(packet);
   }
+}
 
-  return result;
+static void check_channels(const size_t channels) {
+  if (channels != 1 and channels != 3) {
+    throw runtime_error("number of channels must be 1 or 3");
+  }
 }
 
-vector<vector<uint8_t>> decode_frame(AVCodecContext* context, AVFrame* frame,
-                                     AVPacket* packet) {
-  vector<vector<uint8_t>> outputs;
+static void check_image(const vector<uint8_t>& image, const size_t width,
+                        const size_t height, const size_t channels) {
+  check_channels(channels);
 
-  size_t width = frame->width;
-  size_t height = frame->height;
-  int ret = CheckAVCommand("send_packet", avcodec_send_packet(context, packet));
+  if ((channels == 1 and image.size() < width * height) or
+      (channels == 3 and image.size() < width * height * 3 / 2)) {
+    throw runtime_error("unexpected image length");
+  }
+}
 
-  while (ret >= 0) {
-    ret = avcodec_receive_frame(context, frame);
-    if (ret == AVERROR(EAGAIN) or ret == AVERROR_EOF) {
-      return outputs;
-    } else if (ret < 0) {
-      throw runtime_error("receive_frame");
+// a FillPlanes that copies the planar `image` into the frame
+static FillPlanes copy_image(const vector<uint8_t>& image, const size_t width,
+                             const size_t height, const size_t channels) {
+  return [&image, width, height, channels](const YUVPlanes<uint8_t>& planes) {
+    for (size_t row = 0; row < height; row++) {
+      memcpy(planes.data[0] + planes.linesize[0] * row,
+             image.data() + width * row, width);
     }
 
-    vector<uint8_t> output;
-    output.resize(width * height * 3 / 2);
+    if (channels == 3) {
+      for (size_t row = 0; row < height / 2; row++) {
+        memcpy(planes.data[1] + planes.linesize[1] * row,
+               image.data() + width * height + width * row / 2, width / 2);
 
-    for (size_t row = 0; row < height; row++) {
-      memcpy(output.data() + width * row,
-             frame->data[0] + frame->linesize[0] * row, width);
+        memcpy(planes.data[2] + planes.linesize[2] * row,
+               image.data() + 5 * width * height / 4 + width * row / 2,
+               width / 2);
+      }
     }
+  };
+}
 
-    for (size_t row = 0; row < height / 2; row++) {
-      memcpy(output.data() + width * height + width * row / 2,
-             frame->data[1] + frame->linesize[1] * row, width / 2);
+// Codes the picture `fill` writes into the frame as a frame of
+// `pict_type` (AV_PICTURE_TYPE_NONE leaves it to the encoder) and returns
+// its packets, which come out right away unless the encoder holds the
+// frame back.
+static vector<uint8_t> encode_frame(MPEGEncoderSession& session,
+                                    const FillPlanes& fill,
+                                    const size_t channels,
+                                    const AVPictureType pict_type) {
+  AVCodecContext* context = session.context.get();
+  AVFrame* frame = session.frame.get();
+  const size_t height = session.height;
+
+  // the encoder may still hold on to the frame we gave it last time, in
+  // which case this copies it
+  CheckAVCommand("av_frame_make_writable", av_frame_make_writable(frame));
+
+  if (channels == 1 and not session.blank_chroma) {
+    memset(frame->data[1], 0, frame->linesize[1] * height / 2);
+    memset(frame->data[2], 0, frame->linesize[2] * height / 2);
+  }
+  session.blank_chroma = (channels == 1);
+
+  fill({{frame->data[0], frame->data[1], frame->data[2]},
+        {frame->linesize[0], frame->linesize[1], frame->linesize[2]}});
+
+  frame->pts = session.next_pts++;
+  frame->pict_type = pict_type;
+
+  vector<uint8_t> result;
+  CheckAVCommand("avcodec_send_frame", avcodec_send_frame(context, frame));
+  receive_packets(context, session.packet.get(), result);
+  return result;
+}
+
+template <AVCodecID codec_id>
+vector<uint8_t> MPEGEncoder<codec_id>::encode(const vector<uint8_t>& image,
+                                              const size_t width,
+                                              const size_t height,
+                                              const size_t channels) {
+  check_image(image, width, height, channels);
+  return encode(copy_image(image, width, height, channels), width, height,
+                channels);
+}
+
+template <AVCodecID codec_id>
+vector<uint8_t> MPEGEncoder<codec_id>::encode(const FillPlanes& fill,
+                                              const size_t width,
+                                              const size_t height,
+                                              const size_t channels) {
+  check_channels(channels);
+
+  map<EncoderKey, MPEGEncoderSession>& sessions =
+      thread_workspace<SessionPool>().encoders;
+  const EncoderKey key{codec_id_, width, height, quantizer_};
+
+  MPEGEncoderSession& session = find_session(sessions, key, [&] {
+    return open_encoder(codec_id_, pix_fmt_, width, height, quantizer_, 0);
+  });
 
-      memcpy(output.data() + 5 * width * height / 4 + width * row / 2,
-             frame->data[2] + frame->linesize[2] * row, width / 2);
+  vector<uint8_t> result;
+  try {
+    result = encode_frame(session, fill, channels, AV_PICTURE_TYPE_NONE);
+
+    // every frame is an intra frame and there is no lookahead, so the
+    // packet should be out already. If the encoder held it back anyway,
+    // drain it, which leaves the session unusable.
+    if (result.empty()) {
+      AVCodecContext* context = session.context.get();
+      CheckAVCommand("avcodec_send_frame", avcodec_send_frame(context, NULL));
+      receive_packets(context, session.packet.get(), result);
+      sessions.erase(key);
     }
+  } catch (...) {
+    sessions.erase(key);
+    throw;
+  }
+
+  return result;
+}
 
-    outputs.emplace_back(move(output));
+template <AVCodecID codec_id>
+MPEGStreamEncoder<codec_id>::MPEGStreamEncoder(const int quantizer,
+                                               const int gop_size)
+    : quantizer_(quantizer),
+      gop_size_(gop_size),
+      lock_(),
+      session_(),
+      keyframe_requested_(true) {
+  if (gop_size_ < 1) {
+    throw runtime_error("the gop size of a stream must be at least 1");
   }
+}
+
+template <AVCodecID codec_id>
+MPEGStreamEncoder<codec_id>::~MPEGStreamEncoder() {}
 
-  return outputs;
+template <AVCodecID codec_id>
+void MPEGStreamEncoder<codec_id>::request_keyframe() {
+  lock_guard<mutex> lg(lock_);
+  keyframe_requested_ = true;
 }
 
 template <AVCodecID codec_id>
-vector<uint8_t> MPEGDecoder<codec_id>::decode(const vector<uint8_t>& compressed,
-                                              const size_t width,
-                                              const size_t height) {
-  // compressed.resize(compressed.size() + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+vector<uint8_t> MPEGStreamEncoder<codec_id>::encode(
+    const vector<uint8_t>& image, const size_t width, const size_t height,
+    const size_t channels) {
+  check_image(image, width, height, channels);
+  return encode(copy_image(image, width, height, channels), width, height,
+                channels);
+}
 
-  av_log_set_level(AV_LOG_QUIET);
-  avcodec_register_all();
-  AVCodec* decoder =
-      CheckAVCommand("find_decoder", avcodec_find_decoder(codec_id_));
+template <AVCodecID codec_id>
+vector<uint8_t> MPEGStreamEncoder<codec_id>::encode(const FillPlanes& fill,
+                                                    const size_t width,
+                                                    const size_t height,
+                                                    const size_t channels) {
+  check_channels(channels);
+
+  lock_guard<mutex> lg(lock_);
+
+  // a new shape starts a new stream
+  if (not session_ or session_->width != width or session_->height != height) {
+    session_.reset();
+    session_ = make_unique<MPEGEncoderSession>(open_encoder(
+        codec_id_, pix_fmt_, width, height, quantizer_, gop_size_));
+    keyframe_requested_ = true;
+  }
 
-  shared_ptr<AVCodecContext> context{
-      CheckAVCommand("alloc_context", avcodec_alloc_context3(decoder)),
-      [](auto* c) { avcodec_free_context(&c); }};
+  const AVPictureType pict_type =
+      keyframe_requested_ ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
 
-  context->pix_fmt = pix_fmt_;
-  context->width = width;
-  context->height = height;
-  av_opt_set(context->priv_data, "tune", "zerolatency", 0);
+  vector<uint8_t> result;
+  try {
+    result = encode_frame(*session_, fill, channels, pict_type);
+  } catch (...) {
+    session_.reset();
+    throw;
+  }
 
-  shared_ptr<AVCodecParserContext> parser{
-      CheckAVCommand("av_parser_init", av_parser_init(decoder->id)),
-      [](auto* c) { av_parser_close(c); }};
+  // there are no B-frames and no lookahead, so every frame should come
+  // out as soon as it goes in. Frames of a stream cannot be drained
+  // without ending it, so start over with a keyframe instead.
+  if (result.empty()) {
+    session_.reset();
+    throw runtime_error("the encoder held back a frame of the stream");
+  }
 
-  parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+  keyframe_requested_ = false;
+  return result;
+}
 
-  CheckAVCommand("avcodec_open2", avcodec_open2(context.get(), decoder, NULL));
+// Sends `packet` (or, if null, the end of the stream) to the decoder and
+// hands the frames that come out to `consume`, returning how many there
+// were. Only one frame per image is expected.
+static size_t decode_frame(AVCodecContext* context, AVFrame* frame,
+                           AVPacket* packet, const size_t width,
+                           const size_t height, const ConsumePlanes& consume,
+                           size_t decoded) {
+  int ret = CheckAVCommand("send_packet", avcodec_send_packet(context, packet));
 
-  shared_ptr<AVFrame> frame{CheckAVCommand("frame_alloc", av_frame_alloc()),
-                            [](auto* f) { av_frame_free(&f); }};
+  while (ret >= 0) {
+    ret = avcodec_receive_frame(context, frame);
+    if (ret == AVERROR(EAGAIN) or ret == AVERROR_EOF) {
+      return decoded;
+    } else if (ret < 0) {
+      throw runtime_error("receive_frame");
+    }
+
+    if (static_cast<size_t>(frame->width) != width or
+        static_cast<size_t>(frame->height) != height) {
+      throw runtime_error("unexpected frame size");
+    }
 
-  frame->width = width;
-  frame->height = height;
-  frame->format = pix_fmt_;
-  frame->pts = 0;
+    if (decoded > 0) {
+      throw runtime_error("unexpected number of outputs");
+    }
 
-  CheckAVCommand("av_frame_get_buffer", av_frame_get_buffer(frame.get(), 32));
-  CheckAVCommand("av_frame_make_writable", av_frame_make_writable(frame.get()));
+    consume({{frame->data[0], frame->data[1], frame->data[2]},
+             {frame->linesize[0], frame->linesize[1], frame->linesize[2]}});
+    decoded++;
+  }
+
+  return decoded;
+}
+
+// decodes the frames of `compressed`, returning how many there were
+static size_t decode_packets(MPEGDecoderSession& session,
+                             const vector<uint8_t>& compressed,
+                             const ConsumePlanes& consume) {
+  AVCodecContext* context = session.context.get();
 
   AVPacket packet;
   av_init_packet(&packet);
@@ -206,12 +451,12 @@ vector<uint8_t> MPEGDecoder<codec_id>::decode(const vector<uint8_t>& compressed,
   const uint8_t* dataptr = compressed.data();
   int size = compressed.size();
 
-  vector<vector<uint8_t>> outputs;
+  size_t decoded = 0;
 
   while (size > 0) {
     int ret = CheckAVCommand(
         "parser_parse",
-        av_parser_parse2(parser.get(), context.get(), &packet.data,
+        av_parser_parse2(session.parser.get(), context, &packet.data,
                          &packet.size, dataptr, size, AV_NOPTS_VALUE,
                          AV_NOPTS_VALUE, 0));
 
@@ -219,23 +464,128 @@ vector<uint8_t> MPEGDecoder<codec_id>::decode(const vector<uint8_t>& compressed,
     size -= ret;
 
     if (packet.size > 0) {
-      outputs = decode_frame(context.get(), frame.get(), &packet);
+      decoded = decode_frame(context, session.frame.get(), &packet,
+                             session.width, session.height, consume, decoded);
     }
   }
 
-  /* flushing the decoder */
-  auto flushed_outputs = decode_frame(context.get(), frame.get(), nullptr);
-  outputs.insert(outputs.end(), make_move_iterator(flushed_outputs.begin()),
-                 make_move_iterator(flushed_outputs.end()));
+  return decoded;
+}
+
+// a ConsumePlanes that copies the picture into the planar `image`
+static ConsumePlanes copy_planes(vector<uint8_t>& image, const size_t width,
+                                 const size_t height) {
+  return [&image, width, height](const YUVPlanes<const uint8_t>& planes) {
+    image.resize(width * height * 3 / 2);
+
+    for (size_t row = 0; row < height; row++) {
+      memcpy(image.data() + width * row,
+             planes.data[0] + planes.linesize[0] * row, width);
+    }
+
+    for (size_t row = 0; row < height / 2; row++) {
+      memcpy(image.data() + width * height + width * row / 2,
+             planes.data[1] + planes.linesize[1] * row, width / 2);
+
+      memcpy(image.data() + 5 * width * height / 4 + width * row / 2,
+             planes.data[2] + planes.linesize[2] * row, width / 2);
+    }
+  };
+}
+
+template <AVCodecID codec_id>
+vector<uint8_t> MPEGDecoder<codec_id>::decode(const vector<uint8_t>& compressed,
+                                              const size_t width,
+                                              const size_t height) {
+  vector<uint8_t> image;
+  decode(compressed, width, height, copy_planes(image, width, height));
+  return image;
+}
+
+template <AVCodecID codec_id>
+void MPEGDecoder<codec_id>::decode(const vector<uint8_t>& compressed,
+                                   const size_t width, const size_t height,
+                                   const ConsumePlanes& consume) {
+  // compressed.resize(compressed.size() + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+
+  map<DecoderKey, MPEGDecoderSession>& sessions =
+      thread_workspace<SessionPool>().decoders;
+  const DecoderKey key{codec_id_, width, height};
 
-  if (outputs.size() != 1) {
+  MPEGDecoderSession& session = find_session(sessions, key, [&] {
+    return open_decoder(codec_id_, pix_fmt_, width, height);
+  });
+
+  size_t decoded = 0;
+
+  try {
+    decoded = decode_packets(session, compressed, consume);
+
+    // the frame is normally out as soon as its packet is in. Otherwise
+    // flush the decoder, and reset it for the next image.
+    if (decoded == 0) {
+      AVCodecContext* context = session.context.get();
+      decoded = decode_frame(context, session.frame.get(), nullptr, width,
+                             height, consume, decoded);
+      avcodec_flush_buffers(context);
+    }
+  } catch (...) {
+    sessions.erase(key);
+    throw;
+  }
+
+  if (decoded != 1) {
     throw runtime_error("unexpected number of outputs");
   }
+}
+
+template <AVCodecID codec_id>
+MPEGStreamDecoder<codec_id>::MPEGStreamDecoder() : lock_(), session_() {}
+
+template <AVCodecID codec_id>
+MPEGStreamDecoder<codec_id>::~MPEGStreamDecoder() {}
 
-  return outputs.at(0);
+template <AVCodecID codec_id>
+vector<uint8_t> MPEGStreamDecoder<codec_id>::decode(
+    const vector<uint8_t>& compressed, const size_t width,
+    const size_t height) {
+  vector<uint8_t> image;
+  decode(compressed, width, height, copy_planes(image, width, height));
+  return image;
+}
+
+template <AVCodecID codec_id>
+void MPEGStreamDecoder<codec_id>::decode(const vector<uint8_t>& compressed,
+                                         const size_t width,
+                                         const size_t height,
+                                         const ConsumePlanes& consume) {
+  lock_guard<mutex> lg(lock_);
+
+  // a new shape means a new stream, which starts with a keyframe
+  if (not session_ or session_->width != width or session_->height != height) {
+    session_.reset();
+    session_ = make_unique<MPEGDecoderSession>(
+        open_decoder(codec_id_, pix_fmt_, width, height));
+  }
+
+  size_t decoded = 0;
+  try {
+    decoded = decode_packets(*session_, compressed, consume);
+  } catch (...) {
+    session_.reset();
+    throw;
+  }
+
+  if (decoded != 1) {
+    throw runtime_error("unexpected number of outputs");
+  }
 }
 
 template class MPEGEncoder<AV_CODEC_ID_H264>;
 template class MPEGDecoder<AV_CODEC_ID_H264>;
 template class MPEGEncoder<AV_CODEC_ID_H265>;
 template class MPEGDecoder<AV_CODEC_ID_H265>;
+template class MPEGStreamEncoder<AV_CODEC_ID_H264>;
+template class MPEGStreamDecoder<AV_CODEC_ID_H264>;
+template class MPEGStreamEncoder<AV_CODEC_ID_H265>;
+template class MPEGStreamDecoder<AV_CODEC_ID_H265>;
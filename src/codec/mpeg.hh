@@ -5,10 +5,30 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 }
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace codec {
 
+// The Y, U and V planes of a YUV 4:2:0 picture, straight from a frame of
+// the encoder or decoder. The chroma planes are half the width and height
+// of the luma plane, and the rows of every plane are `linesize` bytes
+// apart.
+template <class T>
+struct YUVPlanes {
+  T* data[3];
+  int linesize[3];
+};
+
+typedef std::function<void(const YUVPlanes<uint8_t>&)> FillPlanes;
+typedef std::function<void(const YUVPlanes<const uint8_t>&)> ConsumePlanes;
+
+// an open libavcodec encoder or decoder (see mpeg.cc)
+struct MPEGEncoderSession;
+struct MPEGDecoderSession;
+
 template <AVCodecID codec_id>
 class MPEGEncoder {
  private:
@@ -23,6 +43,12 @@ class MPEGEncoder {
   std::vector<uint8_t> encode(const std::vector<uint8_t>& image,
                               const size_t width, const size_t height,
                               const size_t channels);
+
+  // Encodes the picture `fill` writes straight into the encoder's frame.
+  // With `channels` == 1 only the luma plane is to be filled, and the
+  // chroma planes are left blank.
+  std::vector<uint8_t> encode(const FillPlanes& fill, const size_t width,
+                              const size_t height, const size_t channels);
 };
 
 template <AVCodecID codec_id>
@@ -36,12 +62,72 @@ class MPEGDecoder {
 
   std::vector<uint8_t> decode(const std::vector<uint8_t>& coded_bitstream,
                               const size_t width, const size_t height);
+
+  // Decodes a picture and hands it to `consume` straight from the
+  // decoder's frame, which is only valid for the duration of the call.
+  void decode(const std::vector<uint8_t>& coded_bitstream, const size_t width,
+              const size_t height, const ConsumePlanes& consume);
+};
+
+// Codes a sequence of images as one stream, in which every image is a
+// P-frame predicted from the ones before it except for a keyframe every
+// `gop_size` images, on request, and whenever the image size changes.
+// The images must be decoded in the order they were encoded, by one
+// MPEGStreamDecoder, starting at a keyframe.
+template <AVCodecID codec_id>
+class MPEGStreamEncoder {
+ private:
+  const AVCodecID codec_id_{codec_id};
+  const AVPixelFormat pix_fmt_{AV_PIX_FMT_YUV420P};
+
+  const int quantizer_;
+  const int gop_size_;
+
+  std::mutex lock_;
+  std::unique_ptr<MPEGEncoderSession> session_;
+  bool keyframe_requested_;
+
+ public:
+  MPEGStreamEncoder(const int quantizer, const int gop_size);
+  ~MPEGStreamEncoder();
+
+  // makes the next image a keyframe
+  void request_keyframe();
+
+  std::vector<uint8_t> encode(const std::vector<uint8_t>& image,
+                              const size_t width, const size_t height,
+                              const size_t channels);
+  std::vector<uint8_t> encode(const FillPlanes& fill, const size_t width,
+                              const size_t height, const size_t channels);
+};
+
+template <AVCodecID codec_id>
+class MPEGStreamDecoder {
+ private:
+  const AVCodecID codec_id_{codec_id};
+  const AVPixelFormat pix_fmt_{AV_PIX_FMT_YUV420P};
+
+  std::mutex lock_;
+  std::unique_ptr<MPEGDecoderSession> session_;
+
+ public:
+  MPEGStreamDecoder();
+  ~MPEGStreamDecoder();
+
+  std::vector<uint8_t> decode(const std::vector<uint8_t>& coded_bitstream,
+                              const size_t width, const size_t height);
+  void decode(const std::vector<uint8_t>& coded_bitstream, const size_t width,
+              const size_t height, const ConsumePlanes& consume);
 };
 
 using AVCEncoder = MPEGEncoder<AV_CODEC_ID_H264>;
 using AVCDecoder = MPEGDecoder<AV_CODEC_ID_H264>;
 using HEIFEncoder = MPEGEncoder<AV_CODEC_ID_H265>;
 using HEIFDecoder = MPEGDecoder<AV_CODEC_ID_H265>;
+using AVCStreamEncoder = MPEGStreamEncoder<AV_CODEC_ID_H264>;
+using AVCStreamDecoder = MPEGStreamDecoder<AV_CODEC_ID_H264>;
+using HEIFStreamEncoder = MPEGStreamEncoder<AV_CODEC_ID_H265>;
+using HEIFStreamDecoder = MPEGStreamDecoder<AV_CODEC_ID_H265>;
 
 }  // namespace codec
 
@@ -1,8 +1,14 @@
 #include "utils.hh"
 
 #include <iostream>
+#include <list>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 extern "C" {
 #include <fftw3.h>
@@ -10,13 +16,94 @@ extern "C" {
 
 using namespace std;
 
-static std::mutex plan_lock;
+// the fftw planner is not thread-safe (fftwf_execute_r2r is), so planning,
+// destroying plans and the plan cache are serialized behind this lock. It
+// is recursive because evicting a plan from the cache may destroy it.
+static std::recursive_mutex plan_lock;
 
-nn::Tensor<float, 3> _dct_idct_f32(const nn::Tensor<float, 3>& input_,
-                                   const int N, const bool inverse) {
-  // create non-const copy to work with (deepcopy will memcpy data)
-  nn::Tensor<float, 3> input = input_.deepcopy();
+// plans are measured rather than estimated once wisdom has been loaded
+static unsigned planner_flags = FFTW_ESTIMATE;
+
+// (channels, rows, cols, N, inverse, unaligned)
+typedef std::tuple<int, int, int, int, bool, bool> PlanKey;
+
+// a plan is destroyed once it has left the cache and the last caller
+// running it is done with it
+struct PlanDeleter {
+  void operator()(fftwf_plan plan) const {
+    std::lock_guard<std::recursive_mutex> lg(plan_lock);
+    fftwf_destroy_plan(plan);
+  }
+};
+typedef std::shared_ptr<std::remove_pointer<fftwf_plan>::type> SharedPlan;
+
+// every distinct tensor shape gets a plan of its own, so only the most
+// recently used ones are kept
+static constexpr size_t MAX_CACHED_PLANS = 32;
+
+// most recently used first
+static std::list<std::pair<PlanKey, SharedPlan>> plan_cache;
+static std::map<PlanKey, decltype(plan_cache)::iterator> plan_index;
+
+// Returns a plan that transforms every NxN block of every channel of a
+// channels x rows x cols row-major tensor in one go. The plan is made on
+// scratch arrays (measuring would clobber the caller's) and is meant to
+// be run on the actual arrays with fftwf_execute_r2r.
+static SharedPlan get_plan(const int channels, const int rows, const int cols,
+                           const int N, const bool inverse,
+                           const bool unaligned) {
+  const PlanKey key{channels, rows, cols, N, inverse, unaligned};
+
+  std::lock_guard<std::recursive_mutex> lg(plan_lock);
+
+  const auto cached = plan_index.find(key);
+  if (cached != plan_index.end()) {
+    plan_cache.splice(plan_cache.begin(), plan_cache, cached->second);
+    return cached->second->second;
+  }
+
+  // the two dimensions of a block
+  const fftwf_iodim dims[] = {{N, cols, cols}, {N, 1, 1}};
+
+  // and the channels, block rows and block columns to loop over
+  const fftwf_iodim howmany_dims[] = {
+      {channels, rows * cols, rows * cols},
+      {rows / N, N * cols, N * cols},
+      {cols / N, N, N},
+  };
+
+  const fftwf_r2r_kind kind = inverse ? FFTW_REDFT01 : FFTW_REDFT10;
+  const fftwf_r2r_kind kinds[] = {kind, kind};
+
+  const size_t size = static_cast<size_t>(channels) * rows * cols;
+  float* in = static_cast<float*>(fftwf_malloc(sizeof(float) * size));
+  float* out = static_cast<float*>(fftwf_malloc(sizeof(float) * size));
+
+  const unsigned flags = planner_flags | FFTW_PRESERVE_INPUT |
+                         (unaligned ? FFTW_UNALIGNED : 0);
+  fftwf_plan plan =
+      fftwf_plan_guru_r2r(2, dims, 3, howmany_dims, in, out, kinds, flags);
+
+  fftwf_free(out);
+  fftwf_free(in);
+
+  if (plan == nullptr) {
+    throw runtime_error("could not create an fftw plan");
+  }
+
+  plan_cache.emplace_front(key, SharedPlan(plan, PlanDeleter()));
+  plan_index.emplace(key, plan_cache.begin());
+
+  if (plan_cache.size() > MAX_CACHED_PLANS) {
+    plan_index.erase(plan_cache.back().first);
+    plan_cache.pop_back();
+  }
 
+  return plan_cache.front().second;
+}
+
+nn::Tensor<float, 3> _dct_idct_f32(const nn::Tensor<float, 3>& input,
+                                   const int N, const bool inverse) {
   const int channels = input.dimension(0);
   const int rows = input.dimension(1);
   const int cols = input.dimension(2);
@@ -25,44 +112,24 @@ nn::Tensor<float, 3> _dct_idct_f32(const nn::Tensor<float, 3>& input_,
     throw runtime_error("rows and cols must be multiples of N");
   }
 
-  const int block_rows = rows / N;
-  const int block_cols = cols / N;
-
   nn::Tensor<float, 3> output(channels, rows, cols);
 
-  for (int channel = 0; channel < channels; channel++) {
-    for (int col = 0; col < block_cols; col++) {
-      const int ranks[] = {N, N};
-      const int nembed[] = {rows, cols};
-      const int howmany = block_rows;
-      const int stride = 1;
-      const int dist = (N * cols);
-      float* input_start = &input(channel, 0, 0) + col * N;
-      float* output_start = &output(channel, 0, 0) + col * N;
-      const fftw_r2r_kind kinds[] = {inverse ? FFTW_REDFT01 : FFTW_REDFT10,
-                                     inverse ? FFTW_REDFT01 : FFTW_REDFT10};
-
-      fftwf_plan plan;
-      {
-        std::lock_guard<std::mutex> lg(plan_lock);
-        plan = fftwf_plan_many_r2r(2, ranks, howmany, input_start, nembed,
-                                   stride, dist, output_start, nembed, stride,
-                                   dist, kinds, FFTW_ESTIMATE);
-      }
-
-      fftwf_execute(plan);
-      fftwf_destroy_plan(plan);
-    }
-  }
+  // fftw's interface is not const-correct, but the plan preserves its
+  // input, so there is no need for a copy
+  float* input_data = const_cast<float*>(&input(0, 0, 0));
+  float* output_data = &output(0, 0, 0);
+
+  const bool unaligned = fftwf_alignment_of(input_data) != 0 or
+                         fftwf_alignment_of(output_data) != 0;
+  const SharedPlan plan =
+      get_plan(channels, rows, cols, N, inverse, unaligned);
+  fftwf_execute_r2r(plan.get(), input_data, output_data);
 
   if (not inverse) {
     const float scale_factor = 1.0 / (4 * N * N);
-    for (int i = 0; i < channels; i++) {
-      for (int j = 0; j < rows; j++) {
-        for (int k = 0; k < rows; k++) {
-          output(i, j, k) *= scale_factor;
-        }
-      }
+    const Eigen::Index size = output.size();
+    for (Eigen::Index i = 0; i < size; i++) {
+      output_data[i] *= scale_factor;
     }
   }
 
@@ -78,3 +145,22 @@ nn::Tensor<float, 3> codec::utils::idct(const nn::Tensor<float, 3>& input,
                                         const int N) {
   return _dct_idct_f32(input, N, true);
 }
+
+bool codec::utils::load_fftw_wisdom(const std::string& filename) {
+  std::lock_guard<std::recursive_mutex> lg(plan_lock);
+
+  if (not fftwf_import_wisdom_from_filename(filename.c_str())) {
+    return false;
+  }
+
+  planner_flags = FFTW_MEASURE;
+  return true;
+}
+
+void codec::utils::save_fftw_wisdom(const std::string& filename) {
+  std::lock_guard<std::recursive_mutex> lg(plan_lock);
+
+  if (not fftwf_export_wisdom_to_filename(filename.c_str())) {
+    throw runtime_error("could not write fftw wisdom to " + filename);
+  }
+}
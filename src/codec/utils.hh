@@ -1,13 +1,25 @@
 #ifndef _CODEC_UTILS_HH
 #define _CODEC_UTILS_HH
 
+#include <string>
+
 #include "nn/tensor.hh"
 
 namespace codec::utils {
 
+// blockwise NxN DCT-II and its inverse (DCT-III).
+// The fftw plans of the most recently used shapes are cached, so repeated
+// calls and calls from several threads are cheap.
 nn::Tensor<float, 3> dct(const nn::Tensor<float, 3>& input, const int N = 8);
 nn::Tensor<float, 3> idct(const nn::Tensor<float, 3>& input, const int N = 8);
 
+// imports fftw wisdom from `filename` and switches the planner from
+// estimating to measuring for the plans made after it. Returns false if
+// the file could not be read.
+bool load_fftw_wisdom(const std::string& filename);
+// writes the wisdom accumulated so far to `filename`
+void save_fftw_wisdom(const std::string& filename);
+
 // nn::Tensor<uint8_t, 3> dct(nn::Tensor<uint8_t, 3>& input, const int N = 8);
 // nn::Tensor<uint8_t, 3> idct(nn::Tensor<uint8_t, 3>& input, const int N = 8);
 }  // namespace codec::utils
@@ -0,0 +1,23 @@
+#ifndef _CODEC_WORKSPACE_HH
+#define _CODEC_WORKSPACE_HH
+
+namespace codec {
+
+// Returns the calling thread's `Workspace`, default constructed the first
+// time the thread asks for it and destroyed when the thread exits.
+//
+// Codecs keep what they would otherwise build for every tensor (transform
+// tables, scratch buffers, entropy tables, temporaries) in a workspace
+// of their own. It is set up once per thread and reused for every tensor
+// after that, and since no two threads ever share one, objects with
+// mutable scratch space (like FastDCT) are safe to use from OpenMP
+// threads. Calls that use a workspace must not nest on the same thread.
+template <class Workspace>
+Workspace &thread_workspace() {
+  static thread_local Workspace workspace;
+  return workspace;
+}
+
+}  // namespace codec
+
+#endif  // _CODEC_WORKSPACE_HH
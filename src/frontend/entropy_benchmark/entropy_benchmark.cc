@@ -0,0 +1,351 @@
+#include <H5Cpp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "codec/arithmetic_coder.hh"
+#include "codec/binary_arithmetic_coder.hh"
+#include "codec/huffman.hh"
+#include "nn/tensor.hh"
+#include "nnfc/nnfc2_codec.hh"
+
+// Every backend codes every stream this many times; the fastest run is
+// reported to keep the numbers stable on a busy machine.
+static constexpr int REPETITIONS = 3;
+
+struct SymbolStream {
+  std::string name;
+  uint32_t num_symbols;  // size of the alphabet
+  std::vector<uint32_t> symbols;
+};
+
+struct Backend {
+  std::string name;
+  std::function<std::vector<char>(const SymbolStream&)> encode;
+  std::function<std::vector<uint32_t>(const std::vector<char>&,
+                                      const SymbolStream&)>
+      decode;
+};
+
+//////////////////////////////////////////////////////////////////////
+// streams
+//////////////////////////////////////////////////////////////////////
+
+// two-sided geometric distribution around the middle of the alphabet,
+// the shape of quantized DCT coefficients
+static SymbolStream laplacian_stream(const uint32_t num_symbols,
+                                     const size_t length, const double scale) {
+  std::mt19937 generator(1);
+  std::exponential_distribution<double> magnitude(1.0 / scale);
+  std::bernoulli_distribution sign(0.5);
+
+  const int32_t center = num_symbols / 2;
+  SymbolStream stream{"laplacian", num_symbols, {}};
+  stream.symbols.reserve(length);
+  for (size_t i = 0; i < length; i++) {
+    const int32_t offset =
+        static_cast<int32_t>(std::round(magnitude(generator)));
+    const int32_t value = center + (sign(generator) ? offset : -offset);
+    stream.symbols.push_back(
+        std::min<int32_t>(std::max<int32_t>(value, 0), num_symbols - 1));
+  }
+  return stream;
+}
+
+static SymbolStream geometric_stream(const uint32_t num_symbols,
+                                     const size_t length, const double p) {
+  std::mt19937 generator(2);
+  std::geometric_distribution<uint32_t> distribution(p);
+
+  SymbolStream stream{"geometric", num_symbols, {}};
+  stream.symbols.reserve(length);
+  for (size_t i = 0; i < length; i++) {
+    stream.symbols.push_back(
+        std::min<uint32_t>(distribution(generator), num_symbols - 1));
+  }
+  return stream;
+}
+
+// mostly the middle symbol with the occasional uniform outlier
+static SymbolStream sparse_stream(const uint32_t num_symbols,
+                                  const size_t length, const double density) {
+  std::mt19937 generator(3);
+  std::bernoulli_distribution nonzero(density);
+  std::uniform_int_distribution<uint32_t> outlier(0, num_symbols - 1);
+
+  SymbolStream stream{"sparse", num_symbols, {}};
+  stream.symbols.reserve(length);
+  for (size_t i = 0; i < length; i++) {
+    stream.symbols.push_back(nonzero(generator) ? outlier(generator)
+                                                : num_symbols / 2);
+  }
+  return stream;
+}
+
+// the coefficient symbols NNFC2 hands to its entropy coder for every
+// activation in `dataset_name`
+static SymbolStream nnfc2_stream(const std::string filename,
+                                 const std::string dataset_name) {
+  H5::H5File activations_file(filename, H5F_ACC_RDONLY);
+  H5::DataSet activations = activations_file.openDataSet(dataset_name);
+
+  if (activations.getSpace().getSimpleExtentNdims() != 4) {
+    throw std::runtime_error(filename + ": '" + dataset_name +
+                             "' must be a 4D (N, C, H, W) dataset");
+  }
+
+  hsize_t dims[4];
+  activations.getSpace().getSimpleExtentDims(dims, NULL);
+
+  nn::Tensor<float, 4> batch(dims[0], dims[1], dims[2], dims[3]);
+  activations.read(&batch(0, 0, 0, 0), H5::PredType::NATIVE_FLOAT);
+
+  const nnfc::NNFC2Encoder encoder(0, 1, 0, 0, 8);
+  SymbolStream stream{"nnfc2:" + filename, nnfc::NNFC2Encoder::num_symbols(),
+                      {}};
+
+  const size_t item_size = dims[1] * dims[2] * dims[3];
+  for (size_t item = 0; item < dims[0]; item++) {
+    nn::Tensor<float, 3> activation(&batch(0, 0, 0, 0) + item * item_size,
+                                    dims[1], dims[2], dims[3]);
+
+    const std::vector<uint32_t> symbols =
+        encoder.coefficient_symbols(activation);
+    stream.symbols.insert(stream.symbols.end(), symbols.begin(),
+                          symbols.end());
+  }
+  return stream;
+}
+
+// order-0 entropy of the stream in bits per symbol
+static double empirical_entropy(const SymbolStream& stream) {
+  std::vector<uint64_t> counts(stream.num_symbols, 0);
+  for (const uint32_t symbol : stream.symbols) {
+    counts[symbol]++;
+  }
+
+  const double total = stream.symbols.size();
+  double entropy = 0;
+  for (const uint64_t count : counts) {
+    if (count > 0) {
+      const double p = count / total;
+      entropy -= p * std::log2(p);
+    }
+  }
+  return entropy;
+}
+
+//////////////////////////////////////////////////////////////////////
+// backends
+//////////////////////////////////////////////////////////////////////
+
+template <class Encoder>
+static std::vector<char> arithmetic_encode(const SymbolStream& stream) {
+  Encoder encoder(stream.num_symbols);
+  for (const uint32_t symbol : stream.symbols) {
+    encoder.encode_symbol(symbol);
+  }
+  return encoder.finish();
+}
+
+template <class Decoder>
+static std::vector<uint32_t> arithmetic_decode(const std::vector<char>& data,
+                                               const SymbolStream& stream) {
+  Decoder decoder(data, stream.num_symbols);
+
+  std::vector<uint32_t> symbols;
+  symbols.reserve(stream.symbols.size());
+  while (true) {
+    const uint32_t symbol = decoder.decode_symbol();
+    if (decoder.done()) {
+      break;
+    }
+    symbols.push_back(symbol);
+  }
+  return symbols;
+}
+
+// The binary range coder codes a symbol as the path to its leaf in a
+// complete binary tree, with one context per inner node.
+static uint32_t tree_depth(const uint32_t num_symbols) {
+  uint32_t depth = 0;
+  while ((1u << depth) < num_symbols) {
+    depth++;
+  }
+  return depth;
+}
+
+static std::vector<char> binary_encode(const SymbolStream& stream) {
+  const uint32_t depth = tree_depth(stream.num_symbols);
+  std::vector<codec::BinaryContext> contexts(1 << depth);
+
+  codec::BinaryArithmeticEncoder encoder;
+  for (const uint32_t symbol : stream.symbols) {
+    uint32_t node = 1;
+    for (uint32_t i = depth; i > 0; i--) {
+      const uint32_t bit = (symbol >> (i - 1)) & 0x1;
+      encoder.encode_bit(contexts[node], bit);
+      node = (node << 1) | bit;
+    }
+  }
+  return encoder.finish();
+}
+
+static std::vector<uint32_t> binary_decode(const std::vector<char>& data,
+                                           const SymbolStream& stream) {
+  const uint32_t depth = tree_depth(stream.num_symbols);
+  std::vector<codec::BinaryContext> contexts(1 << depth);
+
+  codec::BinaryArithmeticDecoder decoder(data);
+  std::vector<uint32_t> symbols(stream.symbols.size());
+  for (uint32_t& symbol : symbols) {
+    uint32_t node = 1;
+    for (uint32_t i = 0; i < depth; i++) {
+      node = (node << 1) | decoder.decode_bit(contexts[node]);
+    }
+    symbol = node - (1 << depth);
+  }
+  return symbols;
+}
+
+// Huffman codes are built from the stream's own histogram, which is
+// serialized in front of the codes (and counted in the size).
+static std::vector<char> huffman_encode(const SymbolStream& stream) {
+  std::vector<uint64_t> counts(stream.num_symbols, 0);
+  for (const uint32_t symbol : stream.symbols) {
+    counts[symbol]++;
+  }
+
+  const std::vector<uint8_t> lengths = codec::huffman_code_lengths(counts);
+  std::vector<char> encoding;
+  codec::write_huffman_code_lengths(encoding, lengths);
+
+  const codec::HuffmanTable table(lengths);
+  codec::HuffmanEncoder encoder(table);
+  for (const uint32_t symbol : stream.symbols) {
+    encoder.encode_symbol(symbol);
+  }
+
+  const std::vector<char> codes = encoder.finish();
+  encoding.insert(encoding.end(), codes.begin(), codes.end());
+  return encoding;
+}
+
+static std::vector<uint32_t> huffman_decode(const std::vector<char>& data,
+                                            const SymbolStream& stream) {
+  size_t offset = 0;
+  const codec::HuffmanTable table(
+      codec::read_huffman_code_lengths(data, offset, stream.num_symbols));
+  codec::HuffmanDecoder decoder(
+      std::vector<char>(data.begin() + offset, data.end()), table);
+
+  std::vector<uint32_t> symbols(stream.symbols.size());
+  for (uint32_t& symbol : symbols) {
+    symbol = decoder.decode_symbol();
+  }
+  return symbols;
+}
+
+static std::vector<Backend> backends() {
+  return {
+      {"arithmetic/simple",
+       arithmetic_encode<codec::ArithmeticEncoder<codec::SimpleAdaptiveModel>>,
+       arithmetic_decode<
+           codec::ArithmeticDecoder<codec::SimpleAdaptiveModel>>},
+      {"arithmetic/power_of_two",
+       arithmetic_encode<
+           codec::ArithmeticEncoder<codec::PowerOfTwoAdaptiveModel>>,
+       arithmetic_decode<
+           codec::FastArithmeticDecoder<codec::PowerOfTwoAdaptiveModel>>},
+      {"binary", binary_encode, binary_decode},
+      {"huffman", huffman_encode, huffman_decode},
+  };
+}
+
+//////////////////////////////////////////////////////////////////////
+// driver
+//////////////////////////////////////////////////////////////////////
+
+template <class Function>
+static double fastest_run(Function function) {
+  double best = INFINITY;
+  for (int i = 0; i < REPETITIONS; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    const auto end = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double>(end - start).count());
+  }
+  return best;
+}
+
+static void benchmark(const SymbolStream& stream,
+                      const std::vector<Backend>& backends) {
+  const double num_symbols = stream.symbols.size();
+  std::cout << stream.name << ": " << stream.symbols.size()
+            << " symbols, alphabet " << stream.num_symbols << ", entropy "
+            << std::fixed << std::setprecision(4) << empirical_entropy(stream)
+            << " bits/symbol\n";
+
+  for (const Backend& backend : backends) {
+    std::vector<char> encoding;
+    const double encode_time =
+        fastest_run([&] { encoding = backend.encode(stream); });
+
+    std::vector<uint32_t> decoded;
+    const double decode_time =
+        fastest_run([&] { decoded = backend.decode(encoding, stream); });
+
+    if (decoded != stream.symbols) {
+      throw std::runtime_error(backend.name + " did not round trip " +
+                               stream.name);
+    }
+
+    // MB/s is measured on the compressed bitstream
+    const double megabytes = encoding.size() / 1e6;
+    std::cout << "  " << std::left << std::setw(24) << backend.name
+              << std::right << std::setprecision(4) << std::setw(8)
+              << 8.0 * encoding.size() / num_symbols << " bits/symbol"
+              << std::setprecision(2) << "  encode " << std::setw(7)
+              << num_symbols / encode_time / 1e6 << " Msym/s "
+              << std::setw(7) << megabytes / encode_time << " MB/s"
+              << "  decode " << std::setw(7)
+              << num_symbols / decode_time / 1e6 << " Msym/s "
+              << std::setw(7) << megabytes / decode_time << " MB/s\n";
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2 and argc < 4) {
+    std::cout << "usage: " << argv[0]
+              << " <num_symbols> [<dataset_name> <h5file> [h5file ...]]\n";
+    return -1;
+  }
+
+  const size_t length = std::strtoull(argv[1], nullptr, 10);
+  const uint32_t alphabet = nnfc::NNFC2Encoder::num_symbols();
+
+  std::vector<SymbolStream> streams;
+  streams.push_back(laplacian_stream(alphabet, length, 2.0));
+  streams.push_back(geometric_stream(alphabet, length, 0.3));
+  streams.push_back(sparse_stream(alphabet, length, 0.05));
+  for (int i = 3; i < argc; i++) {
+    streams.push_back(nnfc2_stream(argv[i], argv[2]));
+  }
+
+  const std::vector<Backend> all_backends = backends();
+  for (const SymbolStream& stream : streams) {
+    benchmark(stream, all_backends);
+  }
+
+  return 0;
+}
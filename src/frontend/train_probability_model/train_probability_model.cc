@@ -0,0 +1,112 @@
+#include <H5Cpp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "nn/tensor.hh"
+#include "nnfc/nnfc2_codec.hh"
+
+// Total count the emitted table is normalized to. Small enough that the
+// adaptive model keeps adapting after it has been seeded, large enough
+// to resolve probabilities well below 1%.
+static constexpr uint64_t TABLE_TOTAL = 1 << 15;
+
+static void accumulate_file(const std::string filename,
+                            const std::string dataset_name,
+                            const nnfc::NNFC2Encoder& encoder,
+                            std::vector<uint64_t>& counts) {
+  H5::H5File activations_file(filename, H5F_ACC_RDONLY);
+  H5::DataSet activations = activations_file.openDataSet(dataset_name);
+
+  const size_t ndims = activations.getSpace().getSimpleExtentNdims();
+  if (ndims != 4) {
+    throw std::runtime_error(filename + ": '" + dataset_name +
+                             "' must be a 4D (N, C, H, W) dataset");
+  }
+
+  hsize_t dims[4];
+  activations.getSpace().getSimpleExtentDims(dims, NULL);
+
+  nn::Tensor<float, 4> batch(dims[0], dims[1], dims[2], dims[3]);
+  activations.read(&batch(0, 0, 0, 0), H5::PredType::NATIVE_FLOAT);
+
+  const size_t item_size = dims[1] * dims[2] * dims[3];
+  for (size_t item = 0; item < dims[0]; item++) {
+    nn::Tensor<float, 3> activation(&batch(0, 0, 0, 0) + item * item_size,
+                                    dims[1], dims[2], dims[3]);
+
+    for (const uint32_t symbol : encoder.coefficient_symbols(activation)) {
+      counts[symbol]++;
+    }
+  }
+
+  std::cerr << filename << ": " << dims[0] << " activations of " << dims[1]
+            << "x" << dims[2] << "x" << dims[3] << "\n";
+}
+
+// scale the counts so they sum to roughly TABLE_TOTAL, keeping every
+// symbol codeable
+static std::vector<uint32_t> normalize(const std::vector<uint64_t>& counts) {
+  uint64_t total = 0;
+  for (const uint64_t count : counts) {
+    total += count;
+  }
+  if (total == 0) {
+    throw std::runtime_error("no symbols were collected");
+  }
+
+  std::vector<uint32_t> frequencies(counts.size());
+  for (size_t sym = 0; sym < counts.size(); sym++) {
+    const double scaled =
+        std::round(static_cast<double>(counts[sym]) * TABLE_TOTAL / total);
+    frequencies[sym] = std::max<uint32_t>(1, static_cast<uint32_t>(scaled));
+  }
+
+  return frequencies;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 5) {
+    std::cout << "usage: " << argv[0]
+              << " <table_name> <output_header> <dataset_name> <h5file> "
+                 "[h5file ...]\n";
+    return -1;
+  }
+
+  const std::string table_name = argv[1];
+  const std::string output_filename = argv[2];
+  const std::string dataset_name = argv[3];
+
+  // probability model 0, one slice, multi-symbol arithmetic coder
+  const nnfc::NNFC2Encoder encoder(0, 1, 0, 0, 8);
+  const uint32_t num_symbols = nnfc::NNFC2Encoder::num_symbols();
+
+  std::vector<uint64_t> counts(num_symbols, 0);
+  for (int i = 4; i < argc; i++) {
+    accumulate_file(argv[i], dataset_name, encoder, counts);
+  }
+
+  // the end-of-message symbol is coded once per tensor
+  std::vector<uint32_t> frequencies = normalize(counts);
+  frequencies.push_back(1);
+
+  std::ofstream output(output_filename);
+  output << "// Generated by train_probability_model from " << argc - 4
+         << " file(s), dataset '" << dataset_name << "'.\n";
+  output << "static constexpr uint32_t " << table_name << "_FREQUENCIES[] = {";
+  for (size_t sym = 0; sym < frequencies.size(); sym++) {
+    output << (sym % 10 == 0 ? "\n    " : " ") << frequencies[sym] << ",";
+  }
+  output << "\n};\n\n";
+  output << "// add to NNFC2_PROBABILITY_TABLES:\n";
+  output << "//   {" << num_symbols << ", " << table_name << "_FREQUENCIES},\n";
+
+  std::cerr << "wrote " << table_name << " to " << output_filename << "\n";
+
+  return 0;
+}
@@ -6,12 +6,44 @@
 #include <cmath>
 #include <cstdint>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "nn/tensor.hh"
 using namespace std;
 
-nnfc::JPEGEncoder::JPEGEncoder(int quality) : encoder_(quality) {}
+// every channel is a tile of the JPEG image, padded to whole 8x8 blocks
+// so that no block straddles two channels
+static size_t tile_size(const size_t dim) { return (dim + 7) / 8 * 8; }
+
+// the number of channels every tile of `layout` holds
+static size_t tile_channels(const nnfc::JPEGLayout layout) {
+  return layout == nnfc::JPEGLayout::YUV444 ? 3 : 1;
+}
+
+// maps `size` samples, `stride` apart, back to [min, min + 255 * scale]
+static void dequantize_row(const uint8_t *samples, const size_t stride,
+                           const size_t size, const float min,
+                           const float scale, float *output) {
+  for (size_t i = 0; i < size; i++) {
+    output[i] = samples[stride * i] * scale + min;
+  }
+}
+
+nnfc::JPEGLayout nnfc::jpeg_layout(const int layout) {
+  switch (layout) {
+    case static_cast<int>(JPEGLayout::GRAYSCALE):
+    case static_cast<int>(JPEGLayout::YUV444):
+      return static_cast<JPEGLayout>(layout);
+    default:
+      throw runtime_error("unknown jpeg layout: " + to_string(layout));
+  }
+}
+
+nnfc::JPEGEncoder::JPEGEncoder(int quality, int entropy_coder, int layout)
+    : encoder_(quality, codec::jpeg_entropy_coder(entropy_coder)),
+      layout_(jpeg_layout(layout)) {}
 
 vector<uint8_t> nnfc::JPEGEncoder::forward(nn::Tensor<float, 3> input) {
   const uint64_t dim0 = input.dimension(0);
@@ -21,40 +53,46 @@ vector<uint8_t> nnfc::JPEGEncoder::forward(nn::Tensor<float, 3> input) {
   const float min = input.minimum();
   const float max = input.maximum();
 
-  // create a square grid for the activations to go into
-  const size_t jpeg_chunks = ceil(sqrt(dim0));
-  const size_t jpeg_height = jpeg_chunks * dim1;
-  const size_t jpeg_width = jpeg_chunks * dim2;
+  // create a square grid for the activations to go into, with
+  // `channels` of them interleaved in every tile
+  const size_t channels = tile_channels(layout_);
+  const size_t tile_height = tile_size(dim1);
+  const size_t tile_width = tile_size(dim2);
+  const size_t jpeg_chunks = ceil(sqrt((dim0 + channels - 1) / channels));
+  const size_t jpeg_height = jpeg_chunks * tile_height;
+  const size_t jpeg_width = jpeg_chunks * tile_width;
 
-  vector<uint8_t> buffer(jpeg_height * jpeg_width);
+  vector<uint8_t> buffer(jpeg_height * jpeg_width * channels);
   fill(buffer.begin(), buffer.end(), 0);
 
-  // compute the strides for laying out the data in memory
-  const size_t row_channel_stride = dim1 * dim2;
-  const size_t row_stride = jpeg_chunks * dim2;
-  const size_t channel_stride = dim2;
-
   Eigen::Tensor<uint8_t, 3, Eigen::RowMajor> input_q =
       ((input.tensor() - min) * (255 / (max - min))).cast<uint8_t>();
 
-  // swizzle the data into the right memory layout
-  for (size_t row_channel = 0; row_channel < jpeg_chunks * jpeg_chunks;
-       row_channel += jpeg_chunks) {
-    for (size_t row = 0; row < dim1; row++) {
-      for (size_t channel = 0; channel < jpeg_chunks; channel++) {
-        if (row_channel + channel < dim0) {
-          const size_t offset = row_channel_stride * row_channel +
-                                row_stride * row + channel_stride * channel;
-          memcpy(&buffer[offset], &input_q(row_channel + channel, row, 0),
-                 dim2);
-        }
+  // swizzle the data into the right memory layout, repeating the last
+  // row and column of every channel over the padding
+  for (size_t channel = 0; channel < dim0; channel++) {
+    const size_t tile = channel / channels;
+    const size_t tile_row = tile_height * (tile / jpeg_chunks);
+    const size_t tile_col = tile_width * (tile % jpeg_chunks);
+
+    for (size_t row = 0; row < tile_height; row++) {
+      const size_t input_row = std::min<size_t>(row, dim1 - 1);
+      uint8_t *samples =
+          &buffer[channels * (jpeg_width * (tile_row + row) + tile_col) +
+                  channel % channels];
+
+      for (size_t col = 0; col < tile_width; col++) {
+        const size_t input_col = std::min<size_t>(col, dim2 - 1);
+        samples[channels * col] = input_q(channel, input_row, input_col);
       }
     }
   }
 
   // JPEG compress
   vector<uint8_t> encoding =
-      encoder_.encode(buffer, jpeg_width, jpeg_height, 1);
+      (layout_ == JPEGLayout::YUV444)
+          ? encoder_.encode_ycc(buffer, jpeg_width, jpeg_height)
+          : encoder_.encode(buffer, jpeg_width, jpeg_height, 1);
 
   const uint8_t *min_bytes = reinterpret_cast<const uint8_t *>(&min);
   const uint8_t *max_bytes = reinterpret_cast<const uint8_t *>(&max);
@@ -80,6 +118,12 @@ vector<uint8_t> nnfc::JPEGEncoder::forward(nn::Tensor<float, 3> input) {
     encoding.push_back(dim2_bytes[i]);
   }
 
+  const uint64_t layout = static_cast<uint64_t>(layout_);
+  const uint8_t *layout_bytes = reinterpret_cast<const uint8_t *>(&layout);
+  for (size_t i = 0; i < sizeof(uint64_t); i++) {
+    encoding.push_back(layout_bytes[i]);
+  }
+
   return encoding;
 }
 
@@ -87,9 +131,7 @@ nn::Tensor<float, 3> nnfc::JPEGEncoder::backward(nn::Tensor<float, 3> input) {
   return input;
 }
 
-nnfc::JPEGDecoder::JPEGDecoder()
-    : jpeg_decompressor(tjInitDecompress(), [](void *ptr) { tjDestroy(ptr); }) {
-}
+nnfc::JPEGDecoder::JPEGDecoder() : decoder_() {}
 
 nnfc::JPEGDecoder::~JPEGDecoder() {}
 
@@ -97,70 +139,69 @@ nn::Tensor<float, 3> nnfc::JPEGDecoder::forward(vector<uint8_t> input) {
   uint64_t dim0;
   uint64_t dim1;
   uint64_t dim2;
+  uint64_t layout;
   uint8_t *dim0_bytes = reinterpret_cast<uint8_t *>(&dim0);
   uint8_t *dim1_bytes = reinterpret_cast<uint8_t *>(&dim1);
   uint8_t *dim2_bytes = reinterpret_cast<uint8_t *>(&dim2);
+  uint8_t *layout_bytes = reinterpret_cast<uint8_t *>(&layout);
 
   size_t length = input.size();
-  size_t dim0_offset = length - 3 * sizeof(uint64_t);
-  size_t dim1_offset = length - 2 * sizeof(uint64_t);
-  size_t dim2_offset = length - 1 * sizeof(uint64_t);
+  size_t dim0_offset = length - 4 * sizeof(uint64_t);
+  size_t dim1_offset = length - 3 * sizeof(uint64_t);
+  size_t dim2_offset = length - 2 * sizeof(uint64_t);
+  size_t layout_offset = length - 1 * sizeof(uint64_t);
   for (size_t i = 0; i < sizeof(uint64_t); i++) {
     dim0_bytes[i] = input[i + dim0_offset];
     dim1_bytes[i] = input[i + dim1_offset];
     dim2_bytes[i] = input[i + dim2_offset];
+    layout_bytes[i] = input[i + layout_offset];
   }
 
   float min;
   float max;
   uint8_t *min_bytes = reinterpret_cast<uint8_t *>(&min);
   uint8_t *max_bytes = reinterpret_cast<uint8_t *>(&max);
-  size_t min_offset = length - 3 * sizeof(uint64_t) - 2 * sizeof(float);
-  size_t max_offset = length - 3 * sizeof(uint64_t) - 1 * sizeof(float);
-  for (size_t i = 0; i < sizeof(uint64_t); i++) {
+  size_t min_offset = length - 4 * sizeof(uint64_t) - 2 * sizeof(float);
+  size_t max_offset = length - 4 * sizeof(uint64_t) - 1 * sizeof(float);
+  for (size_t i = 0; i < sizeof(float); i++) {
     min_bytes[i] = input[i + min_offset];
     max_bytes[i] = input[i + max_offset];
   }
 
-  const size_t jpeg_chunks = ceil(sqrt(dim0));
+  const size_t channels = tile_channels(jpeg_layout(layout));
+  const size_t jpeg_chunks = ceil(sqrt((dim0 + channels - 1) / channels));
   const long unsigned int jpeg_size =
-      input.size() - 3 * sizeof(uint64_t) - 2 * sizeof(float);
-
-  int jpegSubsamp, width, height;
-  tjDecompressHeader2(jpeg_decompressor.get(), input.data(), jpeg_size, &width,
-                      &height, &jpegSubsamp);
+      input.size() - 4 * sizeof(uint64_t) - 2 * sizeof(float);
 
-  vector<uint8_t> buffer(width * height);
+  // the channels are laid out in padded tiles (see tile_size)
+  const size_t tile_height = tile_size(dim1);
+  const size_t tile_width = tile_size(dim2);
 
-  tjDecompress2(jpeg_decompressor.get(), input.data(), jpeg_size, buffer.data(),
-                width, 0 /*pitch*/, height, TJPF_GRAY, TJFLAG_FASTDCT);
-
-  // compute the strides for laying out the data in memory
-  const size_t row_channel_stride = dim1 * dim2;
-  const size_t row_stride = jpeg_chunks * dim2;
-  const size_t channel_stride = dim2;
-  const size_t col_stride = 1;
-
-  // swizzle the data into the right memory layout
   nn::Tensor<float, 3> output(dim0, dim1, dim2);
+  const float scale = (max - min) / 255;
+
+  // un-tile and dequantize every row straight into the output
+  decoder_.decode_rows(
+      input.data(), jpeg_size, jpeg_chunks * tile_width,
+      jpeg_chunks * tile_height, channels,
+      [&](const uint8_t *row, const size_t index) {
+        const size_t row_tile = jpeg_chunks * (index / tile_height);
+        const size_t tile_row = index % tile_height;
+        if (tile_row >= dim1) {
+          return;  // padding
+        }
 
-  for (size_t row_channel = 0; row_channel < jpeg_chunks * jpeg_chunks;
-       row_channel += jpeg_chunks) {
-    for (size_t row = 0; row < dim1; row++) {
-      for (size_t channel = 0; channel < jpeg_chunks; channel++) {
-        if (row_channel + channel < dim0) {
-          for (size_t col = 0; col < dim2; col++) {
-            const size_t offset = row_channel_stride * row_channel +
-                                  row_stride * row + channel_stride * channel +
-                                  col_stride * col;
-            const double val = buffer[offset];
-            output(row_channel + channel, row, col) =
-                static_cast<float>((max - min) * (val / 255) + min);
+        for (size_t tile = 0; tile < jpeg_chunks; tile++) {
+          for (size_t component = 0; component < channels; component++) {
+            const size_t channel = channels * (row_tile + tile) + component;
+            if (channel < dim0) {
+              dequantize_row(row + channels * tile_width * tile + component,
+                             channels, dim2, min, scale,
+                             &output(channel, tile_row, 0));
+            }
           }
         }
-      }
-    }
-  }
+      });
 
   return output;
 }
@@ -17,25 +17,40 @@ extern "C" {
 
 namespace nnfc {
 
+// How the channels of a tensor are tiled into the JPEG image. GRAYSCALE
+// gives every channel a tile of a grayscale image. YUV444 puts three
+// channels into the Y, Cb and Cr components of every tile instead (see
+// codec::JPEGEncoder::encode_ycc), which takes an image of a third of the
+// area.
+enum class JPEGLayout { GRAYSCALE = 0, YUV444 = 1 };
+
+// the layout numbered `layout`, or an exception
+JPEGLayout jpeg_layout(const int layout);
+
 class JPEGEncoder {
  private:
   codec::JPEGEncoder encoder_;
+  const JPEGLayout layout_;
 
  public:
-  JPEGEncoder(int quality);
+  // `entropy_coder` picks one of the codec::JPEGEntropyCoder values and
+  // `layout` one of the JPEGLayout values
+  JPEGEncoder(int quality, int entropy_coder, int layout);
   ~JPEGEncoder() {}
 
   std::vector<uint8_t> forward(nn::Tensor<float, 3> input);
   nn::Tensor<float, 3> backward(nn::Tensor<float, 3> input);
 
   static nnfc::cxxapi::constructor_type_list initialization_params() {
-    return {{"quantizer", typeid(int)}};
+    return {{"quantizer", typeid(int)},
+            {"entropy_coder", typeid(int)},
+            {"layout", typeid(int)}};
   }
 };
 
 class JPEGDecoder {
  private:
-  std::unique_ptr<void, void (*)(void*)> jpeg_decompressor;
+  codec::JPEGDecoder decoder_;
 
  public:
   JPEGDecoder();
@@ -11,7 +11,8 @@
 #include "nn/tensor.hh"
 using namespace std;
 
-nnfc::JPEGImageEncoder::JPEGImageEncoder(int quality) : encoder_(quality) {}
+nnfc::JPEGImageEncoder::JPEGImageEncoder(int quality, int entropy_coder)
+    : encoder_(quality, codec::jpeg_entropy_coder(entropy_coder)) {}
 
 vector<uint8_t> nnfc::JPEGImageEncoder::forward(nn::Tensor<float, 3> input) {
   const uint64_t dim0 = input.dimension(0);
@@ -22,14 +22,15 @@ class JPEGImageEncoder {
   codec::JPEGEncoder encoder_;
 
  public:
-  JPEGImageEncoder(int quality);
+  // `entropy_coder` picks one of the codec::JPEGEntropyCoder values
+  JPEGImageEncoder(int quality, int entropy_coder);
   ~JPEGImageEncoder() {}
 
   std::vector<uint8_t> forward(nn::Tensor<float, 3> input);
   nn::Tensor<float, 3> backward(nn::Tensor<float, 3> input);
 
   static nnfc::cxxapi::constructor_type_list initialization_params() {
-    return {{"quantizer", typeid(int)}};
+    return {{"quantizer", typeid(int)}, {"entropy_coder", typeid(int)}};
   }
 };
 
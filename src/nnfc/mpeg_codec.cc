@@ -5,7 +5,11 @@
 #include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "nn/tensor.hh"
@@ -13,49 +17,138 @@
 using namespace std;
 using namespace nnfc;
 
+namespace {
+// Where the tiles of the channels go in a frame: `cols` x `rows` tiles
+// fill the luma plane and, if `chroma` is set, (cols / 2) x (rows / 2)
+// more fill each of the chroma planes, in that order.
+struct Mosaic {
+  size_t cols;
+  size_t rows;
+  bool chroma;
+
+  size_t luma_tiles() const { return cols * rows; }
+  size_t chroma_tiles() const { return chroma ? (cols / 2) * (rows / 2) : 0; }
+  size_t num_tiles() const { return luma_tiles() + 2 * chroma_tiles(); }
+};
+
+// a tile's plane and the pixel its top left corner is at
+struct TilePosition {
+  size_t plane;
+  size_t row;
+  size_t col;
+};
+}  // namespace
+
+// the smallest mosaic of `layout` with room for `dim0` channels
+static Mosaic make_mosaic(const size_t dim0, const MPEGLayout layout) {
+  const size_t chunks = ceil(sqrt(dim0));
+  const Mosaic luma{chunks, chunks, false};
+
+  if (layout == MPEGLayout::LUMA) {
+    return luma;
+  }
+
+  // the chroma planes need an even number of tiles across and down the
+  // luma plane, which takes only 2 / 3 of the channels
+  size_t cols = ceil(sqrt(dim0 / 1.5));
+  cols += cols % 2;
+  size_t rows = (2 * dim0 + 3 * cols - 1) / (3 * cols);
+  rows += rows % 2;
+
+  // that does not pay off for a handful of channels, and the luma plane
+  // may have room for all of them after rounding
+  if (cols * rows >= luma.luma_tiles()) {
+    return luma;
+  }
+  return {cols, rows, cols * rows < dim0};
+}
+
+// the mosaic of a `width` x `height` frame of `dim1` x `dim2` tiles
+static Mosaic frame_mosaic(const size_t dim0, const size_t dim1,
+                           const size_t dim2, const size_t width,
+                           const size_t height) {
+  const size_t cols = width / dim2;
+  const size_t rows = height / dim1;
+  return {cols, rows, cols * rows < dim0};
+}
+
+static TilePosition tile_position(const Mosaic &mosaic, const size_t tile,
+                                  const size_t dim1, const size_t dim2) {
+  if (tile < mosaic.luma_tiles()) {
+    return {0, dim1 * (tile / mosaic.cols), dim2 * (tile % mosaic.cols)};
+  }
+
+  const size_t chroma_tile = tile - mosaic.luma_tiles();
+  const size_t index = chroma_tile % mosaic.chroma_tiles();
+  return {1 + chroma_tile / mosaic.chroma_tiles(),
+          dim1 * (index / (mosaic.cols / 2)),
+          dim2 * (index % (mosaic.cols / 2))};
+}
+
+MPEGLayout nnfc::mpeg_layout(const int layout) {
+  switch (layout) {
+    case static_cast<int>(MPEGLayout::LUMA):
+    case static_cast<int>(MPEGLayout::YUV420):
+      return static_cast<MPEGLayout>(layout);
+    default:
+      throw runtime_error("unknown mpeg layout: " + to_string(layout));
+  }
+}
+
 template <class Encoder>
 vector<uint8_t> MPEGEncoder<Encoder>::forward(nn::Tensor<float, 3> input) {
+  return encode(input, input.minimum(), input.maximum());
+}
+
+template <class Encoder>
+vector<uint8_t> MPEGEncoder<Encoder>::encode(const nn::Tensor<float, 3> &input,
+                                             const float min,
+                                             const float max) {
   const uint64_t dim0 = input.dimension(0);
   const uint64_t dim1 = input.dimension(1);
   const uint64_t dim2 = input.dimension(2);
 
-  const float min = input.minimum();
-  const float max = input.maximum();
+  // create a grid for the activations to go into
+  const Mosaic mosaic = make_mosaic(dim0, layout_);
+  const size_t image_height = mosaic.rows * dim1;
+  const size_t image_width = mosaic.cols * dim2;
 
-  // create a square grid for the activations to go into
-  const size_t image_chunks = ceil(sqrt(dim0));
-  const size_t image_height = image_chunks * dim1;
-  const size_t image_width = image_chunks * dim2;
-
-  vector<uint8_t> buffer(image_height * image_width);
-  fill(buffer.begin(), buffer.end(), 0);
-
-  // compute the strides for laying out the data in memory
-  const size_t row_channel_stride = dim1 * dim2;
-  const size_t row_stride = image_chunks * dim2;
-  const size_t channel_stride = dim2;
-
-  Eigen::Tensor<uint8_t, 3, Eigen::RowMajor> input_q =
-      ((input.tensor() - min) * (255 / (max - min))).cast<uint8_t>();
-
-  // swizzle the data into the right memory layout
-  for (size_t row_channel = 0; row_channel < image_chunks * image_chunks;
-       row_channel += image_chunks) {
-    for (size_t row = 0; row < dim1; row++) {
-      for (size_t channel = 0; channel < image_chunks; channel++) {
-        if (row_channel + channel < dim0) {
-          const size_t offset = row_channel_stride * row_channel +
-                                row_stride * row + channel_stride * channel;
-          memcpy(&buffer[offset], &input_q(row_channel + channel, row, 0),
-                 dim2);
+  const size_t num_tiles = mosaic.num_tiles();
+  // a constant tensor comes back as `min`
+  const float scale = max > min ? 255 / (max - min) : 0;
+
+  // quantize the activations straight into the planes of the encoder's
+  // frame, one tile per channel. The frame is reused, so the tiles that
+  // are left over have to be cleared.
+  const codec::FillPlanes fill_mosaic =
+      [&](const codec::YUVPlanes<uint8_t> &planes) {
+        for (size_t tile = 0; tile < num_tiles; tile++) {
+          const TilePosition tile_pos =
+              tile_position(mosaic, tile, dim1, dim2);
+          const int linesize = planes.linesize[tile_pos.plane];
+
+          for (size_t row = 0; row < dim1; row++) {
+            uint8_t *pixels = planes.data[tile_pos.plane] +
+                              linesize * (tile_pos.row + row) + tile_pos.col;
+
+            if (tile >= dim0) {
+              memset(pixels, 0, dim2);
+              continue;
+            }
+
+            const float *activations = &input(tile, row, 0);
+            for (size_t col = 0; col < dim2; col++) {
+              pixels[col] =
+                  static_cast<uint8_t>((activations[col] - min) * scale);
+            }
+          }
         }
-      }
-    }
-  }
+      };
 
   // AVC compress
+  const size_t channels = mosaic.chroma ? 3 : 1;
   vector<uint8_t> encoding =
-      encoder_.encode(buffer, image_width, image_height, 1);
+      encoder_.encode(fill_mosaic, image_width, image_height, channels);
 
   const uint8_t *min_bytes = reinterpret_cast<const uint8_t *>(&min);
   const uint8_t *max_bytes = reinterpret_cast<const uint8_t *>(&max);
@@ -71,7 +164,8 @@ vector<uint8_t> MPEGEncoder<Encoder>::forward(nn::Tensor<float, 3> input) {
   const uint8_t *dim1_bytes = reinterpret_cast<const uint8_t *>(&dim1);
   const uint8_t *dim2_bytes = reinterpret_cast<const uint8_t *>(&dim2);
   const uint8_t *width_bytes = reinterpret_cast<const uint8_t *>(&image_width);
-  const uint8_t *height_bytes = reinterpret_cast<const uint8_t *>(&image_width);
+  const uint8_t *height_bytes =
+      reinterpret_cast<const uint8_t *>(&image_height);
 
   for (size_t i = 0; i < sizeof(uint64_t); i++) {
     encoding.push_back(dim0_bytes[i]);
@@ -132,45 +226,42 @@ nn::Tensor<float, 3> MPEGDecoder<Decoder>::forward(vector<uint8_t> input) {
   uint8_t *max_bytes = reinterpret_cast<uint8_t *>(&max);
   size_t min_offset = length - 5 * sizeof(uint64_t) - 2 * sizeof(float);
   size_t max_offset = length - 5 * sizeof(uint64_t) - 1 * sizeof(float);
-  for (size_t i = 0; i < sizeof(uint64_t); i++) {
+  for (size_t i = 0; i < sizeof(float); i++) {
     min_bytes[i] = input[i + min_offset];
     max_bytes[i] = input[i + max_offset];
   }
 
   input.resize(input.size() - 5 * sizeof(uint64_t) - 2 * sizeof(float));
 
-  const size_t image_chunks = ceil(sqrt(dim0));
-  vector<uint8_t> buffer = decoder_.decode(input, width, height);
-
-  /* only Y channel is necessary */
-  buffer.resize(width * height);
+  const Mosaic mosaic = frame_mosaic(dim0, dim1, dim2, width, height);
+  if (mosaic.num_tiles() < dim0) {
+    throw runtime_error("the frame is too small for the tensor");
+  }
 
-  // compute the strides for laying out the data in memory
-  const size_t row_channel_stride = dim1 * dim2;
-  const size_t row_stride = image_chunks * dim2;
-  const size_t channel_stride = dim2;
-  const size_t col_stride = 1;
+  const float scale = (max - min) / 255;
 
-  // swizzle the data into the right memory layout
   nn::Tensor<float, 3> output(dim0, dim1, dim2);
 
-  for (size_t row_channel = 0; row_channel < image_chunks * image_chunks;
-       row_channel += image_chunks) {
-    for (size_t row = 0; row < dim1; row++) {
-      for (size_t channel = 0; channel < image_chunks; channel++) {
-        if (row_channel + channel < dim0) {
-          for (size_t col = 0; col < dim2; col++) {
-            const size_t offset = row_channel_stride * row_channel +
-                                  row_stride * row + channel_stride * channel +
-                                  col_stride * col;
-            const double val = buffer[offset];
-            output(row_channel + channel, row, col) =
-                static_cast<float>((max - min) * (val / 255) + min);
+  // un-tile the channels straight out of the decoder's frame
+  decoder_.decode(
+      input, width, height, [&](const codec::YUVPlanes<const uint8_t> &planes) {
+        for (size_t channel = 0; channel < dim0; channel++) {
+          const TilePosition tile_pos =
+              tile_position(mosaic, channel, dim1, dim2);
+          const int linesize = planes.linesize[tile_pos.plane];
+
+          for (size_t row = 0; row < dim1; row++) {
+            const uint8_t *pixels = planes.data[tile_pos.plane] +
+                                    linesize * (tile_pos.row + row) +
+                                    tile_pos.col;
+
+            float *activations = &output(channel, row, 0);
+            for (size_t col = 0; col < dim2; col++) {
+              activations[col] = scale * pixels[col] + min;
+            }
           }
         }
-      }
-    }
-  }
+      });
 
   return output;
 }
@@ -181,7 +272,77 @@ nn::Tensor<float, 3> MPEGDecoder<Decoder>::backward(
   return input;
 }
 
+// the fraction of its span a new range of a stream is widened by on
+// either side, so that the tensors after a keyframe fit in it as well
+static constexpr float RANGE_HEADROOM = 1.f / 16;
+
+template <class Encoder>
+vector<uint8_t> MPEGStreamEncoder<Encoder>::forward(
+    nn::Tensor<float, 3> input) {
+  const float min = input.minimum();
+  const float max = input.maximum();
+  const std::array<Eigen::Index, 3> dims{
+      input.dimension(0), input.dimension(1), input.dimension(2)};
+
+  lock_guard<mutex> lg(range_lock_);
+
+  if (not range_valid_ or dims != range_dims_ or min < range_min_ or
+      max > range_max_) {
+    const float headroom = RANGE_HEADROOM * (max - min);
+    range_min_ = min - headroom;
+    range_max_ = max + headroom;
+    range_dims_ = dims;
+    range_valid_ = true;
+
+    // the frames after this one are predicted from it, so it has to be
+    // the first one quantized over the new range
+    this->encoder_.request_keyframe();
+  }
+
+  // the next tensor starts over if this one could not be coded
+  try {
+    return this->encode(input, range_min_, range_max_);
+  } catch (...) {
+    range_valid_ = false;
+    throw;
+  }
+}
+
+template <class Encoder>
+void MPEGStreamEncoder<Encoder>::request_keyframe() {
+  lock_guard<mutex> lg(range_lock_);
+  range_valid_ = false;
+}
+
+template <class Encoder>
+vector<vector<uint8_t>> MPEGStreamEncoder<Encoder>::forward_batch(
+    const vector<nn::Tensor<float, 3>> &inputs) {
+  vector<vector<uint8_t>> encodings;
+  for (const nn::Tensor<float, 3> &input : inputs) {
+    encodings.push_back(this->forward(input));
+  }
+  return encodings;
+}
+
+template <class Decoder>
+vector<nn::Tensor<float, 3>> MPEGStreamDecoder<Decoder>::forward_batch(
+    const vector<vector<uint8_t>> &inputs) {
+  vector<nn::Tensor<float, 3>> outputs;
+  for (const vector<uint8_t> &input : inputs) {
+    outputs.push_back(this->forward(input));
+  }
+  return outputs;
+}
+
 template class MPEGEncoder<codec::AVCEncoder>;
 template class MPEGDecoder<codec::AVCDecoder>;
 template class MPEGEncoder<codec::HEIFEncoder>;
 template class MPEGDecoder<codec::HEIFDecoder>;
+template class MPEGEncoder<codec::AVCStreamEncoder>;
+template class MPEGDecoder<codec::AVCStreamDecoder>;
+template class MPEGEncoder<codec::HEIFStreamEncoder>;
+template class MPEGDecoder<codec::HEIFStreamDecoder>;
+template class MPEGStreamEncoder<codec::AVCStreamEncoder>;
+template class MPEGStreamDecoder<codec::AVCStreamDecoder>;
+template class MPEGStreamEncoder<codec::HEIFStreamEncoder>;
+template class MPEGStreamDecoder<codec::HEIFStreamDecoder>;
@@ -1,8 +1,10 @@
 #ifndef _NNFC_AVC_CODEC_HH
 #define _NNFC_AVC_CODEC_HH
 
+#include <array>
 #include <cstdint>
 #include <functional>
+#include <mutex>
 #include <vector>
 
 extern "C" {
@@ -17,26 +19,47 @@ extern "C" {
 
 namespace nnfc {
 
+// How the channels of a tensor are tiled into the frames. LUMA only
+// fills the luma plane and leaves the chroma planes blank. YUV420 puts
+// tiles of the same size into the chroma planes as well, which at 4:2:0
+// subsampling hold half as many again as the luma plane, so the frame
+// can be up to a third smaller. The decoder tells the two apart from the
+// size of the frame.
+enum class MPEGLayout { LUMA = 0, YUV420 = 1 };
+
+// the layout numbered `layout`, or an exception
+MPEGLayout mpeg_layout(const int layout);
+
 template <class Encoder>
 class MPEGEncoder {
- private:
+ protected:
   Encoder encoder_;
+  const MPEGLayout layout_;
+
+  // codes `input` with its values mapped from [min, max] to [0, 255]
+  std::vector<uint8_t> encode(const nn::Tensor<float, 3> &input,
+                              const float min, const float max);
 
  public:
-  MPEGEncoder(int quantizer) : encoder_(quantizer) {}
+  // `layout` picks one of the MPEGLayout values, and the quantizer and
+  // any `encoder_args` go to the Encoder
+  template <class... EncoderArgs>
+  MPEGEncoder(const int quantizer, const int layout,
+              const EncoderArgs... encoder_args)
+      : encoder_(quantizer, encoder_args...), layout_(mpeg_layout(layout)) {}
   ~MPEGEncoder() {}
 
   std::vector<uint8_t> forward(nn::Tensor<float, 3> input);
   nn::Tensor<float, 3> backward(nn::Tensor<float, 3> input);
 
   static nnfc::cxxapi::constructor_type_list initialization_params() {
-    return {{"quantizer", typeid(int)}};
+    return {{"quantizer", typeid(int)}, {"layout", typeid(int)}};
   }
 };
 
 template <class Decoder>
 class MPEGDecoder {
- private:
+ protected:
   Decoder decoder_{};
 
  public:
@@ -51,10 +74,66 @@ class MPEGDecoder {
   }
 };
 
+// Codes the tensors of consecutive calls, and the items of a batch in
+// order, as the frames of one stream (see codec::MPEGStreamEncoder), so
+// that each tensor is predicted from the ones before it. The decoder has
+// to see the encodings in the same order.
+//
+// A P-frame only predicts well if the same activation maps to the same
+// pixel as in the frames before it, so the [min, max] range the values
+// are quantized over is held fixed between keyframes. It is picked, with
+// some headroom, on the first tensor, on request_keyframe() and when the
+// shape changes, and a tensor that does not fit in it starts a new range
+// and a keyframe.
+template <class Encoder>
+class MPEGStreamEncoder : public MPEGEncoder<Encoder> {
+ private:
+  std::mutex range_lock_;
+  bool range_valid_;
+  float range_min_;
+  float range_max_;
+  std::array<Eigen::Index, 3> range_dims_;
+
+ public:
+  MPEGStreamEncoder(int quantizer, int gop_size, int layout)
+      : MPEGEncoder<Encoder>(quantizer, layout, gop_size),
+        range_lock_(),
+        range_valid_(false),
+        range_min_(0),
+        range_max_(0),
+        range_dims_() {}
+
+  std::vector<uint8_t> forward(nn::Tensor<float, 3> input);
+  std::vector<std::vector<uint8_t>> forward_batch(
+      const std::vector<nn::Tensor<float, 3>> &inputs);
+
+  // makes the next tensor a keyframe with a range of its own
+  void request_keyframe();
+
+  static nnfc::cxxapi::constructor_type_list initialization_params() {
+    return {{"quantizer", typeid(int)},
+            {"gop_size", typeid(int)},
+            {"layout", typeid(int)}};
+  }
+};
+
+template <class Decoder>
+class MPEGStreamDecoder : public MPEGDecoder<Decoder> {
+ public:
+  MPEGStreamDecoder() {}
+
+  std::vector<nn::Tensor<float, 3>> forward_batch(
+      const std::vector<std::vector<uint8_t>> &inputs);
+};
+
 using AVCEncoder = MPEGEncoder<codec::AVCEncoder>;
 using AVCDecoder = MPEGDecoder<codec::AVCDecoder>;
 using HEIFEncoder = MPEGEncoder<codec::HEIFEncoder>;
 using HEIFDecoder = MPEGDecoder<codec::HEIFDecoder>;
+using AVCStreamEncoder = MPEGStreamEncoder<codec::AVCStreamEncoder>;
+using AVCStreamDecoder = MPEGStreamDecoder<codec::AVCStreamDecoder>;
+using HEIFStreamEncoder = MPEGStreamEncoder<codec::HEIFStreamEncoder>;
+using HEIFStreamDecoder = MPEGStreamDecoder<codec::HEIFStreamDecoder>;
 }  // namespace nnfc
 
 #endif  // _NNFC_AVC_CODEC_HH
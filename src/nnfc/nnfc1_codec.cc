@@ -2,14 +2,18 @@
 
 #include <algorithm>
 #include <cassert>
-#include <cfloat>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <exception>
 #include <iostream>
-#include <random>
+#include <limits>
+#include <mutex>
+#include <numeric>
 #include <vector>
 
+#include "codec/arithmetic_coder.hh"
+#include "codec/huffman.hh"
 #include "codec/utils.hh"
 #include "nn/tensor.hh"
 #include "nnfc1_codec.hh"
@@ -18,118 +22,330 @@ using namespace std;
 
 static constexpr int BLOCK_WIDTH = 4;
 
-static std::vector<float> kmeans(nn::Tensor<float, 3> input, int nbins,
-                                 int max_iter = 10) {
-  const int dim0 = input.dimension(0);
-  const int dim1 = input.dimension(1);
-  const int dim2 = input.dimension(2);
-  std::vector<float> vals(&input(0, 0, 0),
-                          &input(0, 0, 0) + dim0 * dim1 * dim2);
-  const int vals_size = vals.size();
+// entropy coders, selected with the `entropy_coder` parameter: the
+// quantized values packed at log2(nbins) bits each, a canonical Huffman
+// code built from the histogram of the tensor, or an adaptive arithmetic
+// coder
+static constexpr int32_t NO_ENTROPY_CODER = 0;
+static constexpr int32_t HUFFMAN_ENTROPY_CODER = 1;
+static constexpr int32_t ARITHMETIC_ENTROPY_CODER = 2;
+
+// The codebook field of the footer holds the id of the shared codebook
+// the means come from (0 for a tensor's own codebook), flagged with
+// CODEBOOK_CARRIED when the encoding carries the means themselves.
+static constexpr uint32_t CODEBOOK_CARRIED = 1u << 31;
+
+// the footer: codebook, entropy coder, number of bins and dimensions
+static constexpr size_t FOOTER_SIZE = sizeof(uint32_t) + sizeof(int32_t) +
+                                      sizeof(uint32_t) + 3 * sizeof(uint64_t);
+
+// maps `func` over `inputs` in parallel and rethrows the first failure
+// once all of them are done
+template <class Output, class Input, class Func>
+static std::vector<Output> parallel_map(const std::vector<Input> &inputs,
+                                        Func func) {
+  const size_t size = inputs.size();
+  std::vector<Output> outputs(size);
+  std::vector<std::exception_ptr> errors(size);
+
+#pragma omp parallel for if (size > 1)
+  for (size_t i = 0; i < size; i++) {
+    try {
+      outputs[i] = func(inputs[i]);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  }
 
-  // use kmeans++ initialization strategy
-  assert(nbins > 1);
-  std::vector<float> means(nbins);
+  for (const std::exception_ptr &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  return outputs;
+}
 
-  // initialize the means
-  {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::vector<float> distances_squared(vals_size);
-
-    // set the initial mean and distances
-    {
-      std::uniform_int_distribution<> dist(0, vals_size - 1);
-      means[0] = vals[dist(gen)];
-
-      for (int i = 0; i < vals_size; i++) {
-        const float val = vals[i];
-        distances_squared[i] = (means[0] - val) * (means[0] - val);
-      }
+// the number of histogram bins kmeans clusters, which bounds its error to
+// 1/4096th of the range of the input
+static constexpr int KMEANS_HISTOGRAM_BINS = 4096;
+
+namespace {
+// Optimal clustering of weighted 1-D points (histogram bins, in order)
+// into contiguous groups by dynamic programming. The split points of the
+// optimal solutions are monotone, so every level is filled in by divide
+// and conquer in O(n log n).
+class ClusterSolver {
+ private:
+  // prefix sums of the weights, values and squared values of the points
+  std::vector<double> weights_;
+  std::vector<double> sums_;
+  std::vector<double> squares_;
+
+  std::vector<double> previous_cost_{};
+  std::vector<double> cost_{};
+
+ public:
+  // the first point of the last cluster of the best solution for every
+  // prefix, one row per number of clusters
+  std::vector<std::vector<int>> splits{};
+
+  ClusterSolver(std::vector<double> weights, std::vector<double> sums,
+                std::vector<double> squares)
+      : weights_(std::move(weights)),
+        sums_(std::move(sums)),
+        squares_(std::move(squares)) {}
+
+  int size() const { return weights_.size() - 1; }
+
+  // the squared error of the cluster of points [begin, end)
+  double error(const int begin, const int end) const {
+    const double weight = weights_[end] - weights_[begin];
+    if (weight <= 0) {
+      return 0;
     }
+    const double sum = sums_[end] - sums_[begin];
+    return std::max(0.0, squares_[end] - squares_[begin] - sum * sum / weight);
+  }
 
-    // set the other nbins-1 means
-    {
-      for (int bin = 1; bin < nbins; bin++) {
-        std::discrete_distribution<> d(distances_squared.begin(),
-                                       distances_squared.end());
+  double mean(const int begin, const int end) const {
+    return (sums_[end] - sums_[begin]) / (weights_[end] - weights_[begin]);
+  }
 
-        const int new_mean_idx = d(gen);
-        means[bin] = vals[new_mean_idx];
+  // the best solutions with one more cluster for the prefixes in
+  // [end_lo, end_hi), whose last clusters start in [begin_lo, begin_hi]
+  void fill(const int end_lo, const int end_hi, const int begin_lo,
+            const int begin_hi) {
+    if (end_lo >= end_hi) {
+      return;
+    }
 
-        for (int i = 0; i < vals_size; i++) {
-          const float val = vals[i];
-          const float curr_distance_squared =
-              (means[bin] - val) * (means[bin] - val);
-          if (curr_distance_squared < distances_squared[i]) {
-            distances_squared[i] = curr_distance_squared;
-          }
-        }
+    const int end = (end_lo + end_hi) / 2;
+    double best_cost = std::numeric_limits<double>::infinity();
+    int best_begin = begin_lo;
+    for (int begin = begin_lo; begin <= std::min(begin_hi, end - 1); begin++) {
+      const double cost = previous_cost_[begin] + error(begin, end);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_begin = begin;
       }
     }
+
+    cost_[end] = best_cost;
+    splits.back()[end] = best_begin;
+
+    fill(end_lo, end, begin_lo, best_begin);
+    fill(end + 1, end_hi, best_begin, begin_hi);
   }
 
-  // perform kmeans `max_iter` times
-  std::vector<float> means_sum(nbins);
-  std::vector<float> means_count(nbins);
+  void solve(const int clusters) {
+    const int n = size();
+    previous_cost_.assign(n + 1, 0);
+    cost_.assign(n + 1, 0);
+
+    // one cluster
+    splits.assign(1, std::vector<int>(n + 1, 0));
+    for (int end = 1; end <= n; end++) {
+      previous_cost_[end] = error(0, end);
+    }
 
-  for (int iter = 0; iter < max_iter; iter++) {
-    for (int i = 0; i < nbins; i++) {
-      means_count[i] = 0;
-      means_sum[i] = 0;
+    for (int cluster = 1; cluster < clusters; cluster++) {
+      // the prefixes need at least one point per cluster
+      splits.emplace_back(n + 1, 0);
+      fill(cluster + 1, n + 1, cluster, n - 1);
+      std::swap(previous_cost_, cost_);
     }
+  }
+};
+}  // namespace
+
+// Exact 1-D k-means: the `nbins` means (in ascending order) that minimize
+// the squared error of the values of all of `inputs`, computed over a
+// fine histogram of the values. Deterministic, and linear in the size of
+// the inputs.
+static std::vector<float> kmeans(
+    const std::vector<nn::Tensor<float, 3>> &inputs, const int nbins) {
+  assert(nbins > 1);
 
-    for (int i = 0; i < vals_size; i++) {
-      const float val = vals[i];
+  float min = std::numeric_limits<float>::infinity();
+  float max = -std::numeric_limits<float>::infinity();
+  for (const nn::Tensor<float, 3> &input : inputs) {
+    const float *vals = &input(0, 0, 0);
+    const size_t vals_size = input.size();
+    min = std::min(min, *std::min_element(vals, vals + vals_size));
+    max = std::max(max, *std::max_element(vals, vals + vals_size));
+  }
+  if (not(max > min)) {
+    return std::vector<float>(nbins, min);
+  }
 
-      int best_mean = -1;
-      float best_distance = FLT_MAX;
-      for (int j = 0; j < nbins; j++) {
-        const float curr_distance = (means[j] - val) * (means[j] - val);
-        if (curr_distance < best_distance) {
-          best_distance = curr_distance;
-          best_mean = j;
-        }
-      }
+  // the count, sum and sum of squares of the values in every bin, relative
+  // to the minimum to keep the sums well conditioned
+  std::vector<double> counts(KMEANS_HISTOGRAM_BINS, 0);
+  std::vector<double> sums(KMEANS_HISTOGRAM_BINS, 0);
+  std::vector<double> squares(KMEANS_HISTOGRAM_BINS, 0);
+
+  const float bin_scale = KMEANS_HISTOGRAM_BINS / (max - min);
+  for (const nn::Tensor<float, 3> &input : inputs) {
+    const float *vals = &input(0, 0, 0);
+    const size_t vals_size = input.size();
+    for (size_t i = 0; i < vals_size; i++) {
+      const float val = vals[i] - min;
+      const int bin = std::min(KMEANS_HISTOGRAM_BINS - 1,
+                               static_cast<int>(val * bin_scale));
+      counts[bin] += 1;
+      sums[bin] += val;
+      squares[bin] += static_cast<double>(val) * val;
+    }
+  }
 
-      assert(best_mean >= 0);
-      means_count[best_mean] += 1;
-      means_sum[best_mean] += val;
+  // prefix sums over the occupied bins
+  std::vector<double> weight_sums{0};
+  std::vector<double> value_sums{0};
+  std::vector<double> square_sums{0};
+  for (int bin = 0; bin < KMEANS_HISTOGRAM_BINS; bin++) {
+    if (counts[bin] > 0) {
+      weight_sums.push_back(weight_sums.back() + counts[bin]);
+      value_sums.push_back(value_sums.back() + sums[bin]);
+      square_sums.push_back(square_sums.back() + squares[bin]);
     }
   }
 
-  for (int i = 0; i < nbins; i++) {
-    means[i] = means_sum[i] / means_count[i];
+  ClusterSolver solver(std::move(weight_sums), std::move(value_sums),
+                       std::move(square_sums));
+  const int points = solver.size();
+
+  // with no more occupied bins than means, every bin gets its own
+  const int clusters = std::min(nbins, points);
+  solver.solve(clusters);
+
+  std::vector<float> means(nbins, max);
+  int end = points;
+  for (int cluster = clusters - 1; cluster >= 0; cluster--) {
+    const int begin = solver.splits[cluster][end];
+    means[cluster] = min + solver.mean(begin, end);
+    end = begin;
   }
 
   std::sort(means.begin(), means.end());
   return means;
 }
 
-static uint32_t quantize(float val, std::vector<float> &bins) {
-  int lower = 0;
-  int upper = bins.size() - 1;
+// the boundaries between the (sorted) `means`: a value quantizes to the
+// number of boundaries it is not below, i.e. to its nearest mean
+static std::vector<float> quantizer_thresholds(
+    const std::vector<float> &means) {
+  std::vector<float> thresholds;
+  for (size_t bin = 1; bin < means.size(); bin++) {
+    thresholds.push_back((means[bin - 1] + means[bin]) / 2);
+  }
+  return thresholds;
+}
 
-  while (upper - lower > 1) {
-    int mid = (lower + upper) / 2;
+// quantizes `size` values against `thresholds` without branches, so the
+// compiler can vectorize it
+static void quantize(const float *vals, const size_t size,
+                     const std::vector<float> &thresholds, uint8_t *qvals) {
+  std::fill_n(qvals, size, 0);
+  for (const float threshold : thresholds) {
+    for (size_t i = 0; i < size; i++) {
+      qvals[i] += vals[i] >= threshold;
+    }
+  }
+}
+
+// the number of values a dim0 x dim1 x dim2 tensor codes: those of its
+// whole BLOCK_WIDTH x BLOCK_WIDTH blocks
+static size_t coded_count(const uint64_t dim0, const uint64_t dim1,
+                          const uint64_t dim2) {
+  return dim0 * (dim1 / BLOCK_WIDTH) * (dim2 / BLOCK_WIDTH) * BLOCK_WIDTH *
+         BLOCK_WIDTH;
+}
 
-    if (bins[mid] < val) {
-      lower = mid;
-    } else {
-      upper = mid;
+// the number of bits a value of `nbins` bins takes
+static int symbol_bits(const uint32_t nbins) {
+  int bits = 0;
+  while ((1u << bits) < nbins) {
+    bits++;
+  }
+  return bits;
+}
+
+// packs `bits` wide symbols into bytes, least significant bits first
+static std::vector<uint8_t> pack_symbols(const std::vector<uint8_t> &symbols,
+                                         const int bits) {
+  std::vector<uint8_t> packed;
+  packed.reserve((symbols.size() * bits + 7) / 8);
+
+  uint32_t buffer = 0;
+  int buffered_bits = 0;
+  for (const uint8_t symbol : symbols) {
+    buffer |= static_cast<uint32_t>(symbol) << buffered_bits;
+    buffered_bits += bits;
+    while (buffered_bits >= 8) {
+      packed.push_back(buffer & 0xff);
+      buffer >>= 8;
+      buffered_bits -= 8;
     }
   }
+  if (buffered_bits > 0) {
+    packed.push_back(buffer & 0xff);
+  }
 
-  float lower_error = val - bins[lower];
-  float upper_error = bins[upper] - val;
-  if (lower_error < upper_error) {
-    return lower;
-  } else {
-    return upper;
+  return packed;
+}
+
+static std::vector<uint8_t> unpack_symbols(const uint8_t *packed,
+                                           const size_t packed_size,
+                                           const size_t count,
+                                           const int bits) {
+  if (packed_size < (count * bits + 7) / 8) {
+    throw std::runtime_error("nnfc1 input is too short");
+  }
+
+  std::vector<uint8_t> symbols(count);
+  const uint32_t mask = (1u << bits) - 1;
+
+  uint32_t buffer = 0;
+  int buffered_bits = 0;
+  size_t offset = 0;
+  for (uint8_t &symbol : symbols) {
+    while (buffered_bits < bits) {
+      buffer |= static_cast<uint32_t>(packed[offset++]) << buffered_bits;
+      buffered_bits += 8;
+    }
+    symbol = buffer & mask;
+    buffer >>= bits;
+    buffered_bits -= bits;
   }
+
+  return symbols;
 }
 
-nnfc::NNFC1Encoder::NNFC1Encoder() : quantizer_nbins_(4) {}
+// the adaptive model of the arithmetic coder starts every one of the
+// `nbins` symbols (and the end of message) with a count of one
+static codec::ProbabilityTable uniform_table(
+    const uint32_t nbins, std::vector<uint32_t> &frequencies) {
+  frequencies.assign(nbins + 1, 1);
+  return {nbins, frequencies.data()};
+}
+
+nnfc::NNFC1Encoder::NNFC1Encoder(int entropy_coder, int codebook_refresh)
+    : quantizer_nbins_(4),
+      entropy_coder_(entropy_coder),
+      codebook_refresh_(codebook_refresh),
+      codebook_(),
+      codebook_id_(0),
+      codebook_batches_(0) {
+  if (entropy_coder_ != NO_ENTROPY_CODER and
+      entropy_coder_ != HUFFMAN_ENTROPY_CODER and
+      entropy_coder_ != ARITHMETIC_ENTROPY_CODER) {
+    throw std::runtime_error("unknown nnfc1 entropy coder: " +
+                             std::to_string(entropy_coder_));
+  }
+  if (codebook_refresh_ < 0) {
+    throw std::runtime_error("nnfc1 codebook refresh must not be negative");
+  }
+}
 
 nnfc::NNFC1Encoder::~NNFC1Encoder() {}
 
@@ -141,18 +357,80 @@ constexpr int ZIGZAG_ORDER[][2] = {
 vector<uint8_t> nnfc::NNFC1Encoder::forward(nn::Tensor<float, 3> input) {
   // nn::Tensor<float, 3> input(move(codec::utils::dct(t_input, BLOCK_WIDTH)));
 
+  if (codebook_refresh_ > 0) {
+    return forward_batch({input})[0];
+  }
+
+  return encode(input, kmeans({input}, quantizer_nbins_), CODEBOOK_CARRIED);
+}
+
+vector<vector<uint8_t>> nnfc::NNFC1Encoder::forward_batch(
+    const vector<nn::Tensor<float, 3>> &inputs) {
+  if (codebook_refresh_ == 0) {
+    return parallel_map<vector<uint8_t>>(
+        inputs, [this](const nn::Tensor<float, 3> &input) {
+          return encode(input, kmeans({input}, quantizer_nbins_),
+                        CODEBOOK_CARRIED);
+        });
+  }
+
+  if (inputs.empty()) {
+    return {};
+  }
+
+  // cluster the whole batch into a new codebook every `codebook_refresh_`
+  // batches
+  if (codebook_.empty() or codebook_batches_ >= codebook_refresh_) {
+    codebook_ = kmeans(inputs, quantizer_nbins_);
+    codebook_id_ = codebook_id_ % (CODEBOOK_CARRIED - 1) + 1;
+    codebook_batches_ = 0;
+  }
+  codebook_batches_++;
+
+  // the first item carries the codebook, so every batch decodes on its own
+  vector<size_t> items(inputs.size());
+  iota(items.begin(), items.end(), 0);
+
+  return parallel_map<vector<uint8_t>>(items, [this, &inputs](size_t item) {
+    return encode(inputs[item], codebook_,
+                  item == 0 ? codebook_id_ | CODEBOOK_CARRIED : codebook_id_);
+  });
+}
+
+vector<uint8_t> nnfc::NNFC1Encoder::encode(const nn::Tensor<float, 3> &input,
+                                           const vector<float> &means,
+                                           const uint32_t codebook) const {
   uint64_t dim0 = input.dimension(0);
   uint64_t dim1 = input.dimension(1);
   uint64_t dim2 = input.dimension(2);
 
   assert(__builtin_popcount(quantizer_nbins_) == 1);
   assert(quantizer_nbins_ < 256);
-  std::vector<float> means = kmeans(input, quantizer_nbins_);
-
-  std::vector<uint8_t> encoding;
 
   const uint64_t block_rows = dim1 / BLOCK_WIDTH;
   const uint64_t block_cols = dim2 / BLOCK_WIDTH;
+  const size_t coded_rows = block_rows * BLOCK_WIDTH;
+  const size_t coded_cols = block_cols * BLOCK_WIDTH;
+
+  // quantize the values of the whole blocks in memory order (a channel at
+  // a time if no columns are dropped), then gather them in coding order
+  const std::vector<float> thresholds = quantizer_thresholds(means);
+  std::vector<uint8_t> input_qvals(coded_count(dim0, dim1, dim2));
+  for (size_t i = 0; i < dim0; i++) { /* channels */
+    uint8_t *channel_qvals = input_qvals.data() + i * coded_rows * coded_cols;
+    if (coded_cols == dim2) {
+      quantize(&input(i, 0, 0), coded_rows * coded_cols, thresholds,
+               channel_qvals);
+      continue;
+    }
+    for (size_t j = 0; j < coded_rows; j++) {
+      quantize(&input(i, j, 0), coded_cols, thresholds,
+               channel_qvals + j * coded_cols);
+    }
+  }
+
+  std::vector<uint8_t> encoding;
+  encoding.reserve(input_qvals.size());
 
   for (size_t i = 0; i < dim0; i++) { /* channels */
     for (size_t jj = 0; jj < block_rows; jj++) {
@@ -161,27 +439,77 @@ vector<uint8_t> nnfc::NNFC1Encoder::forward(nn::Tensor<float, 3> input) {
           const size_t j = ZIGZAG_ORDER[zz][0];
           const size_t k = ZIGZAG_ORDER[zz][1];
 
-          const float val =
-              input(i, jj * BLOCK_WIDTH + j, kk * BLOCK_WIDTH + k);
-
-          const uint32_t qval = quantize(val, means);
-          assert(qval <= 0xff);
-          encoding.push_back(static_cast<uint8_t>(qval));
+          encoding.push_back(
+              input_qvals[(i * coded_rows + jj * BLOCK_WIDTH + j) *
+                              coded_cols +
+                          kk * BLOCK_WIDTH + k]);
         }
       }
     }
   }
+  assert(encoding.size() == coded_count(dim0, dim1, dim2));
+
+  if (entropy_coder_ == NO_ENTROPY_CODER) {
+    encoding = pack_symbols(encoding, symbol_bits(quantizer_nbins_));
+  } else if (entropy_coder_ == ARITHMETIC_ENTROPY_CODER) {
+    std::vector<uint32_t> frequencies;
+    codec::ArithmeticEncoder<codec::PowerOfTwoAdaptiveModel> encoder(
+        uniform_table(quantizer_nbins_, frequencies));
+    for (const uint8_t qval : encoding) {
+      encoder.encode_symbol(qval);
+    }
 
-  {
+    const std::vector<char> codes = encoder.finish();
+    encoding.assign(codes.begin(), codes.end());
+  } else if (entropy_coder_ == HUFFMAN_ENTROPY_CODER) {
+    std::vector<uint64_t> counts(quantizer_nbins_, 0);
+    for (const uint8_t qval : encoding) {
+      counts[qval]++;
+    }
+
+    const std::vector<uint8_t> lengths = codec::huffman_code_lengths(counts);
+    const codec::HuffmanTable table(lengths);
+
+    codec::HuffmanEncoder encoder(table);
+    for (const uint8_t qval : encoding) {
+      encoder.encode_symbol(qval);
+    }
+
+    std::vector<char> huffman_encoding;
+    codec::write_huffman_code_lengths(huffman_encoding, lengths);
+    const std::vector<char> codes = encoder.finish();
+    huffman_encoding.insert(huffman_encoding.end(), codes.begin(),
+                            codes.end());
+
+    encoding.assign(huffman_encoding.begin(), huffman_encoding.end());
+  }
+
+  if (codebook & CODEBOOK_CARRIED) {
     for (int bin = 0; bin < quantizer_nbins_; bin++) {
-      uint8_t *bin_bytes = reinterpret_cast<uint8_t *>(&means[bin]);
+      const uint8_t *bin_bytes = reinterpret_cast<const uint8_t *>(&means[bin]);
       for (size_t i = 0; i < sizeof(float); i++) {
         encoding.push_back(bin_bytes[i]);
       }
     }
   }
 
+  {
+    const uint8_t *codebook_bytes =
+        reinterpret_cast<const uint8_t *>(&codebook);
+    for (size_t i = 0; i < sizeof(uint32_t); i++) {
+      encoding.push_back(codebook_bytes[i]);
+    }
+  }
+
   // 1 * 4 bytes for number of bins
+  {
+    int32_t entropy_coder = entropy_coder_;
+    uint8_t *entropy_coder_bytes = reinterpret_cast<uint8_t *>(&entropy_coder);
+    for (size_t i = 0; i < sizeof(int32_t); i++) {
+      encoding.push_back(entropy_coder_bytes[i]);
+    }
+  }
+
   {
     uint32_t nbins = quantizer_nbins_;
     uint8_t *nbins_bytes = reinterpret_cast<uint8_t *>(&nbins);
@@ -213,12 +541,92 @@ nn::Tensor<float, 3> nnfc::NNFC1Encoder::backward(nn::Tensor<float, 3> input) {
   return input;
 }
 
-nnfc::NNFC1Decoder::NNFC1Decoder() {}
+nnfc::NNFC1Decoder::NNFC1Decoder()
+    : codebook_lock_(), codebook_id_(0), codebook_() {}
 
 nnfc::NNFC1Decoder::~NNFC1Decoder() {}
 
+// the codebook field of `input` (see CODEBOOK_CARRIED)
+static uint32_t codebook_field(const vector<uint8_t> &input) {
+  if (input.size() < FOOTER_SIZE) {
+    throw std::runtime_error("nnfc1 input is too short");
+  }
+
+  uint32_t codebook;
+  uint8_t *codebook_bytes = reinterpret_cast<uint8_t *>(&codebook);
+  const size_t codebook_offset = input.size() - FOOTER_SIZE;
+  for (size_t i = 0; i < sizeof(uint32_t); i++) {
+    codebook_bytes[i] = input[i + codebook_offset];
+  }
+  return codebook;
+}
+
+vector<float> nnfc::NNFC1Decoder::codebook(const vector<uint8_t> &input) {
+  const uint32_t codebook = codebook_field(input);
+  const uint32_t codebook_id = codebook & ~CODEBOOK_CARRIED;
+
+  uint32_t nbins;
+  {
+    uint8_t *nbins_bytes = reinterpret_cast<uint8_t *>(&nbins);
+    size_t nbins_offset = input.size() - 3 * sizeof(uint64_t) /* dims[3] */
+                          - 1 * sizeof(uint32_t) /* nbins */;
+    for (size_t i = 0; i < sizeof(uint32_t); i++) {
+      nbins_bytes[i] = input[i + nbins_offset];
+    }
+  }
+
+  if (not(codebook & CODEBOOK_CARRIED)) {
+    std::lock_guard<std::mutex> lg(codebook_lock_);
+    if (codebook_id == 0 or codebook_id != codebook_id_ or
+        codebook_.size() != nbins) {
+      throw std::runtime_error("nnfc1 input refers to an unknown codebook");
+    }
+    return codebook_;
+  }
+
+  if (input.size() < FOOTER_SIZE + nbins * sizeof(float)) {
+    throw std::runtime_error("nnfc1 input is too short");
+  }
+
+  std::vector<float> means(nbins);
+  for (uint32_t bin = 0; bin < nbins; bin++) {
+    size_t bin_offset =
+        input.size() - FOOTER_SIZE - (nbins - bin) * sizeof(float);
+
+    uint8_t *bin_bytes = reinterpret_cast<uint8_t *>(&means[bin]);
+    for (size_t i = 0; i < sizeof(float); i++) {
+      bin_bytes[i] = input[i + bin_offset];
+    }
+  }
+
+  // remember the shared codebook for the encodings that refer to it
+  if (codebook_id != 0) {
+    std::lock_guard<std::mutex> lg(codebook_lock_);
+    codebook_id_ = codebook_id;
+    codebook_ = means;
+  }
+
+  return means;
+}
+
+vector<nn::Tensor<float, 3>> nnfc::NNFC1Decoder::forward_batch(
+    const vector<vector<uint8_t>> &inputs) {
+  // pick up the shared codebooks the batch carries before decoding the
+  // items that refer to them
+  for (const vector<uint8_t> &input : inputs) {
+    const uint32_t codebook = codebook_field(input);
+    if ((codebook & CODEBOOK_CARRIED) and codebook != CODEBOOK_CARRIED) {
+      this->codebook(input);
+    }
+  }
+
+  return parallel_map<nn::Tensor<float, 3>>(
+      inputs, [this](const vector<uint8_t> &input) { return forward(input); });
+}
+
 nn::Tensor<float, 3> nnfc::NNFC1Decoder::forward(vector<uint8_t> input) {
   const size_t length = input.size();
+  const bool codebook_carried = codebook_field(input) & CODEBOOK_CARRIED;
 
   uint64_t dim0;
   uint64_t dim1;
@@ -251,26 +659,74 @@ nn::Tensor<float, 3> nnfc::NNFC1Decoder::forward(vector<uint8_t> input) {
   }
   assert(nbins < 256);
 
-  std::vector<float> means;
-  means.resize(nbins);
+  int32_t entropy_coder;
   {
-    for (uint32_t bin = 0; bin < nbins; bin++) {
-      size_t bin_offset = length - (nbins - bin) * sizeof(float) -
-                          3 * sizeof(uint64_t) - 1 * sizeof(uint32_t);
-
-      uint8_t *bin_bytes = reinterpret_cast<uint8_t *>(&means[bin]);
-      for (size_t i = 0; i < sizeof(float); i++) {
-        bin_bytes[i] = input[i + bin_offset];
-      }
+    uint8_t *entropy_coder_bytes = reinterpret_cast<uint8_t *>(&entropy_coder);
+    size_t entropy_coder_offset = length - 3 * sizeof(uint64_t) /* dims[3] */
+                                  - 1 * sizeof(uint32_t)        /* nbins */
+                                  - 1 * sizeof(int32_t) /* entropy coder */;
+    for (size_t i = 0; i < sizeof(int32_t); i++) {
+      entropy_coder_bytes[i] = input[i + entropy_coder_offset];
     }
   }
 
+  const std::vector<float> means = codebook(input);
+
   nn::Tensor<float, 3> output(dim0, dim1, dim2);
 
   const uint64_t block_rows = dim1 / BLOCK_WIDTH;
   const uint64_t block_cols = dim2 / BLOCK_WIDTH;
 
-  uint32_t count = 0;
+  // the quantized values of the whole blocks, in coding order
+  std::vector<uint8_t> qvals;
+  const size_t count = coded_count(dim0, dim1, dim2);
+  const size_t encoding_length =
+      length - FOOTER_SIZE - (codebook_carried ? nbins * sizeof(float) : 0);
+
+  if (entropy_coder == NO_ENTROPY_CODER) {
+    // the encoder packed exactly `count` values
+    if (encoding_length != (count * symbol_bits(nbins) + 7) / 8) {
+      throw std::runtime_error("nnfc1 input has the wrong length");
+    }
+    qvals = unpack_symbols(input.data(), encoding_length, count,
+                           symbol_bits(nbins));
+  } else if (entropy_coder == ARITHMETIC_ENTROPY_CODER) {
+    std::vector<uint32_t> frequencies;
+    codec::FastArithmeticDecoder<codec::PowerOfTwoAdaptiveModel> decoder(
+        std::vector<char>(input.begin(), input.begin() + encoding_length),
+        uniform_table(nbins, frequencies));
+
+    qvals.resize(count);
+    for (uint8_t &qval : qvals) {
+      qval = decoder.decode_symbol();
+    }
+  } else if (entropy_coder == HUFFMAN_ENTROPY_CODER) {
+    const std::vector<char> encoding(input.begin(),
+                                     input.begin() + encoding_length);
+
+    size_t offset = 0;
+    const codec::HuffmanTable table(
+        codec::read_huffman_code_lengths(encoding, offset, nbins));
+    codec::HuffmanDecoder decoder(
+        std::vector<char>(encoding.begin() + offset, encoding.end()), table);
+
+    // exactly the values the encoder wrote, rather than running on into
+    // the zeros the decoder reads past the end of its data
+    qvals.resize(count);
+    for (uint8_t &qval : qvals) {
+      qval = decoder.decode_symbol();
+    }
+  } else {
+    throw std::runtime_error("unknown nnfc1 entropy coder: " +
+                             std::to_string(entropy_coder));
+  }
+
+  // the rows and columns past the last whole block were not coded
+  if (block_rows * BLOCK_WIDTH != dim1 or block_cols * BLOCK_WIDTH != dim2) {
+    output.tensor().setZero();
+  }
+
+  size_t qval_idx = 0;
   for (size_t i = 0; i < dim0; i++) { /* channels */
     for (size_t jj = 0; jj < block_rows; jj++) {
       for (size_t kk = 0; kk < block_cols; kk++) {
@@ -278,9 +734,9 @@ nn::Tensor<float, 3> nnfc::NNFC1Decoder::forward(vector<uint8_t> input) {
           const size_t j = ZIGZAG_ORDER[zz][0];
           const size_t k = ZIGZAG_ORDER[zz][1];
 
-          uint8_t qval = input[count];
+          uint8_t qval = qvals[qval_idx];
           output(i, jj * BLOCK_WIDTH + j, kk * BLOCK_WIDTH + k) = means[qval];
-          count++;
+          qval_idx++;
         }
       }
     }
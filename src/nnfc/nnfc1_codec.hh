@@ -4,6 +4,7 @@
 #include <turbojpeg.h>
 
 #include <cstdint>
+#include <mutex>
 #include <vector>
 
 #include "nn/tensor.hh"
@@ -14,26 +15,64 @@ namespace nnfc {
 class NNFC1Encoder {
  private:
   const int quantizer_nbins_;
+  const int32_t entropy_coder_;
+  const int32_t codebook_refresh_;
+
+  // the shared codebook, its id and the number of batches it has coded
+  std::vector<float> codebook_;
+  uint32_t codebook_id_;
+  int32_t codebook_batches_;
+
+  std::vector<uint8_t> encode(const nn::Tensor<float, 3> &input,
+                              const std::vector<float> &means,
+                              uint32_t codebook) const;
 
  public:
-  NNFC1Encoder();
+  // `entropy_coder` 0 packs the quantized values at log2(nbins) bits
+  // each, 1 codes them with a Huffman code built for every tensor and 2
+  // with an adaptive arithmetic coder.
+  //
+  // With a `codebook_refresh` of 0 every tensor gets its own codebook.
+  // Otherwise a codebook is clustered over a whole batch, reused for
+  // `codebook_refresh` batches and sent along with the first tensor of
+  // each batch only; the others refer to it by id.
+  //
+  // Only whole 4x4 blocks are coded. The rows and columns past the last
+  // whole block of a channel are dropped and decode as 0.
+  NNFC1Encoder(int entropy_coder, int codebook_refresh);
   ~NNFC1Encoder();
 
   std::vector<uint8_t> forward(nn::Tensor<float, 3> input);
+  std::vector<std::vector<uint8_t>> forward_batch(
+      const std::vector<nn::Tensor<float, 3>> &inputs);
   nn::Tensor<float, 3> backward(nn::Tensor<float, 3> input);
 
   static nnfc::cxxapi::constructor_type_list initialization_params() {
-    return {};
+    return {{"entropy_coder", typeid(int)},
+            {"codebook_refresh", typeid(int)}};
   }
 };
 
 class NNFC1Decoder {
  private:
+  // the latest shared codebook seen and its id (0 before any). Every
+  // batch carries the codebook its tensors refer to, so older ones are
+  // never needed again.
+  std::mutex codebook_lock_;
+  uint32_t codebook_id_;
+  std::vector<float> codebook_;
+
+  std::vector<float> codebook(const std::vector<uint8_t> &input);
+
  public:
   NNFC1Decoder();
   ~NNFC1Decoder();
 
+  // a tensor that refers to a shared codebook decodes once the tensor
+  // carrying that codebook has
   nn::Tensor<float, 3> forward(std::vector<uint8_t> input);
+  std::vector<nn::Tensor<float, 3>> forward_batch(
+      const std::vector<std::vector<uint8_t>> &inputs);
   nn::Tensor<float, 3> backward(nn::Tensor<float, 3> input);
 
   static nnfc::cxxapi::constructor_type_list initialization_params() {
@@ -1,16 +1,26 @@
+#include <algorithm>
 #include <any>
 #include <cstdint>
+#include <exception>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <chrono>
 
 #include "codec/arithmetic_coder.hh"
+#include "codec/binary_arithmetic_coder.hh"
 #include "codec/fastdct.hh"
+#include "codec/huffman.hh"
 #include "codec/utils.hh"
+#include "codec/workspace.hh"
 #include "nn/tensor.hh"
 
 #include "nnfc2_codec.hh"
+#include "nnfc2_probability_tables.hh"
 
 static constexpr int BLOCK_WIDTH = 8;
 
@@ -99,344 +109,1345 @@ static constexpr int JPEG_QUANTIZATION_LENGTH =
     sizeof(JPEG_QUANTIZATION) / sizeof(JPEG_QUANTIZATION[0]);
 static_assert(ZIGZAG_LENGTH == JPEG_QUANTIZATION_LENGTH);
 
+// the largest block size and its number of coefficients
+static constexpr int MAX_BLOCK_WIDTH = 16;
+static constexpr int MAX_BLOCK_LENGTH = MAX_BLOCK_WIDTH * MAX_BLOCK_WIDTH;
+
+// The zigzag order and quantization matrix (in zigzag order) of a block
+// size. 8x8 blocks use the tables above. The others follow the same
+// zigzag pattern and quantize every coefficient like the 8x8 coefficient
+// of the same spatial frequency.
+struct BlockShape {
+  int width;
+  int length;
+  int zigzag_order[MAX_BLOCK_LENGTH][2];
+  int quantization[MAX_BLOCK_LENGTH];
+};
+
+static BlockShape make_block_shape(const int width) {
+  BlockShape shape{};
+  shape.width = width;
+  shape.length = width * width;
+
+  if (width == BLOCK_WIDTH) {
+    std::copy(&ZIGZAG_ORDER[0][0], &ZIGZAG_ORDER[0][0] + 2 * ZIGZAG_LENGTH,
+              &shape.zigzag_order[0][0]);
+    std::copy(JPEG_QUANTIZATION, JPEG_QUANTIZATION + ZIGZAG_LENGTH,
+              shape.quantization);
+    return shape;
+  }
+
+  // odd anti-diagonals run down to the left, even ones up to the right
+  int i = 0;
+  for (int diagonal = 0; diagonal < 2 * width - 1; diagonal++) {
+    const int first_row = std::max(0, diagonal - width + 1);
+    const int last_row = std::min(diagonal, width - 1);
+    for (int k = 0; k <= last_row - first_row; k++) {
+      const int row = diagonal % 2 ? first_row + k : last_row - k;
+      shape.zigzag_order[i][0] = row;
+      shape.zigzag_order[i][1] = diagonal - row;
+      i++;
+    }
+  }
+
+  int quantization_8x8[BLOCK_WIDTH][BLOCK_WIDTH];
+  for (int j = 0; j < ZIGZAG_LENGTH; j++) {
+    quantization_8x8[ZIGZAG_ORDER[j][0]][ZIGZAG_ORDER[j][1]] =
+        JPEG_QUANTIZATION[j];
+  }
+  for (int j = 0; j < shape.length; j++) {
+    shape.quantization[j] =
+        quantization_8x8[shape.zigzag_order[j][0] * BLOCK_WIDTH / width]
+                        [shape.zigzag_order[j][1] * BLOCK_WIDTH / width];
+  }
+
+  return shape;
+}
+
+// the shape of the 4x4, 8x8 or 16x16 blocks
+static const BlockShape &block_shape(const int width) {
+  static const BlockShape shapes[] = {make_block_shape(4), make_block_shape(8),
+                                      make_block_shape(16)};
+  switch (width) {
+    case 4:
+      return shapes[0];
+    case 8:
+      return shapes[1];
+    case 16:
+      return shapes[2];
+    default:
+      throw std::runtime_error("unsupported nnfc2 block size: " +
+                               std::to_string(width));
+  }
+}
+
 // inclusive range of values the DCT coefficients can take on
 static constexpr int32_t DCT_MIN = -64;
 static constexpr int32_t DCT_MAX = 64;
 
-nnfc::NNFC2Encoder::NNFC2Encoder() : quality_(48) {}
+// Coefficients map to symbols [0, DCT_MAX - DCT_MIN]. Two control
+// symbols follow: EOB ends a block early (all remaining coefficients in
+// zigzag order are zero) and ZERO_BLOCK replaces a whole block whose
+// samples are all zero. Neither block needs an (I)DCT.
+static constexpr uint32_t EOB_SYMBOL = DCT_MAX - DCT_MIN + 1;
+static constexpr uint32_t ZERO_BLOCK_SYMBOL = EOB_SYMBOL + 1;
+
+// number of symbols in the alphabet (excludes the end-of-message symbol
+// added by the probability model)
+static constexpr uint32_t NUM_SYMBOLS = ZERO_BLOCK_SYMBOL + 1;
+
+// entropy coders, selected with the `entropy_coder` parameter: adaptive
+// arithmetic coding over the symbol alphabet above, binary arithmetic
+// coding of a binarization of the coefficients (see encode_bins) or
+// canonical Huffman coding of the symbol alphabet
+static constexpr int32_t ARITHMETIC_ENTROPY_CODER = 0;
+static constexpr int32_t BINARY_ENTROPY_CODER = 1;
+static constexpr int32_t HUFFMAN_ENTROPY_CODER = 2;
+
+// DCT implementations, selected with the `dct_method` parameter: the
+// accurate and the fast (AAN) integer DCTs of libjpeg-turbo (see
+// codec::DCTMethod) and the floating point DCT of codec::utils
+static constexpr int32_t ISLOW_DCT = 0;
+static constexpr int32_t IFAST_DCT = 1;
+static constexpr int32_t FLOAT_DCT = 2;
+
+// dims (3 * uint64_t), min and max (2 * float), quality, probability
+// model id, entropy coder, dct method and block size (5 * int32_t),
+// number of slices (uint32_t). The slice offset table (one uint64_t end
+// offset per slice) sits right before it.
+static constexpr size_t FOOTER_SIZE = 3 * sizeof(uint64_t) +
+                                      2 * sizeof(float) +
+                                      5 * sizeof(int32_t) + sizeof(uint32_t);
+
+template <typename T>
+static void write_footer_field(std::vector<char> &encoding, const T value) {
+  const char *bytes = reinterpret_cast<const char *>(&value);
+  for (size_t i = 0; i < sizeof(T); i++) {
+    encoding.push_back(bytes[i]);
+  }
+}
 
-nnfc::NNFC2Encoder::~NNFC2Encoder() {}
+template <typename T>
+static T read_footer_field(const std::vector<uint8_t> &input, size_t &offset) {
+  T value;
+  uint8_t *bytes = reinterpret_cast<uint8_t *>(&value);
+  for (size_t i = 0; i < sizeof(T); i++) {
+    bytes[i] = input[offset + i];
+  }
+  offset += sizeof(T);
+  return value;
+}
 
-std::vector<uint8_t> nnfc::NNFC2Encoder::forward(
-    const nn::Tensor<float, 3> t_input) const {
-  const uint64_t dim0 = t_input.dimension(0);
-  const uint64_t dim1 = t_input.dimension(1);
-  const uint64_t dim2 = t_input.dimension(2);
+static codec::ProbabilityTable probability_table(const int32_t model_id) {
+  // model 0 starts every symbol with a count of one
+  static const std::vector<uint32_t> uniform_frequencies(NUM_SYMBOLS + 1, 1);
 
-  assert(dim1 % BLOCK_WIDTH == 0);
-  assert(dim2 % BLOCK_WIDTH == 0);
+  if (model_id == 0) {
+    return {NUM_SYMBOLS, uniform_frequencies.data()};
+  }
 
-  const float min = t_input.minimum();
-  const float max = t_input.maximum();
-  const float range = max - min;
+  if (model_id < 0 or
+      static_cast<size_t>(model_id) > nnfc::NNFC2_NUM_PROBABILITY_TABLES) {
+    throw std::runtime_error("unknown nnfc2 probability model: " +
+                             std::to_string(model_id));
+  }
+
+  const codec::ProbabilityTable table =
+      nnfc::NNFC2_PROBABILITY_TABLES[model_id - 1];
+  if (table.num_symbols != NUM_SYMBOLS) {
+    throw std::runtime_error("nnfc2 probability model " +
+                             std::to_string(model_id) +
+                             " does not match the coefficient alphabet");
+  }
+
+  return table;
+}
+
+// Huffman code lengths for a trained probability table (model id > 0).
+// With model 0 every slice carries code lengths built from its own
+// histogram instead.
+static std::vector<uint8_t> trained_code_lengths(
+    const codec::ProbabilityTable table) {
+  const std::vector<uint64_t> counts(table.frequencies,
+                                     table.frequencies + table.num_symbols);
+  return codec::huffman_code_lengths(counts);
+}
+
+namespace {
+// what a thread needs to code a slice, kept from one tensor to the next
+// (see codec::thread_workspace)
+struct Workspace {
+  codec::FastDCT islow_dct{codec::best_dct_kernel(), codec::DCTMethod::ISLOW};
+  codec::FastIDCT islow_idct{codec::best_dct_kernel(),
+                             codec::DCTMethod::ISLOW};
+  codec::FastDCT ifast_dct{codec::best_dct_kernel(), codec::DCTMethod::IFAST};
+  codec::FastIDCT ifast_idct{codec::best_dct_kernel(),
+                             codec::DCTMethod::IFAST};
+
+  // the 8-bit samples of a slice and its zero block flags
+  std::vector<int16_t> samples{};
+  std::vector<uint8_t> zero_blocks{};
+
+  // the coefficients of a row of blocks
+  std::vector<int16_t> coefficients{};
+
+  // the samples or coefficients of a slice and the level of every flat
+  // block (or -1), for the float dct
+  std::vector<float> float_buffer{};
+  std::vector<int16_t> block_levels{};
+
+  // the decoded 8-bit samples of a row of blocks
+  std::vector<uint8_t> band{};
+
+  // the symbols of a slice, for the Huffman coder
+  std::vector<uint32_t> symbols{};
+
+  // Huffman tables of the trained probability models, by model id
+  std::map<int32_t, codec::HuffmanTable> huffman_tables{};
+};
+
+
+// Turns decoded 8-bit samples into the decoder's output, one band (a row
+// of blocks of a channel) at a time while the band is still in cache,
+// cropping off the padding.
+struct SampleWriter {
+  nn::Tensor<float, 3> output;
+  float min;
+  float range;
+
+  void write_band(const nn::Tensor<uint8_t, 3> &band, const size_t channel,
+                  const size_t row_offset) {
+    const size_t rows = std::min<size_t>(band.dimension(1),
+                                         output.dimension(1) - row_offset);
+    const size_t cols = output.dimension(2);
+
+    for (size_t row = 0; row < rows; row++) {
+      const uint8_t *sample_row = &band(0, row, 0);
+      float *output_row = &output(channel, row_offset + row, 0);
+      for (size_t col = 0; col < cols; col++) {
+        output_row[col] =
+            ((1 / 255.f) * (range * static_cast<float>(sample_row[col]))) +
+            min;
+      }
+    }
+  }
+};
+}  // namespace
+
+// the Huffman table of trained probability model `model_id`
+static const codec::HuffmanTable &trained_huffman_table(
+    Workspace &workspace, const int32_t model_id,
+    const codec::ProbabilityTable table) {
+  auto huffman_table = workspace.huffman_tables.find(model_id);
+  if (huffman_table == workspace.huffman_tables.end()) {
+    huffman_table =
+        workspace.huffman_tables
+            .emplace(model_id, codec::HuffmanTable(trained_code_lengths(table)))
+            .first;
+  }
+  return huffman_table->second;
+}
+
+// channels [first, second) belong to `slice`
+static std::pair<uint64_t, uint64_t> slice_channels(const uint64_t channels,
+                                                    const uint32_t num_slices,
+                                                    const uint32_t slice) {
+  return {(channels * slice) / num_slices,
+          (channels * (slice + 1)) / num_slices};
+}
+
+static float quality_scale(const int32_t quality) {
+  assert(quality > 0);
+  assert(quality <= 100);
+  return quality < 50 ? 50.f / quality : (100.f - quality) / 50;
+}
+
+// Rounds half away from zero like std::round, but in a form the
+// compiler can vectorize: the truncation is exact and so is the
+// fraction it leaves.
+static inline int32_t round_to_int(const float value) {
+  const int32_t whole = static_cast<int32_t>(value);
+  const float fraction = value - static_cast<float>(whole);
+  return whole + (fraction >= 0.5f) - (fraction <= -0.5f);
+}
+
+// the 8-bit level of `value` when [min, max] maps onto [0, 255]
+static inline int16_t sample_level(const float value, const float min,
+                                   const float gain) {
+  return static_cast<int16_t>(round_to_int((value - min) * gain));
+}
+
+// the factor that maps [min, max] onto [0, 255]. A constant tensor maps
+// onto level 0, which keeps NaNs out of round_to_int.
+static float sample_gain(const float min, const float max) {
+  return max > min ? 255.f / (max - min) : 0.f;
+}
+
+// the 8-bit level an input of exactly zero quantizes to, or -1 if zero
+// is outside of [min, max]
+static int16_t zero_level(const float min, const float max) {
+  if (min > 0 or max < 0) {
+    return -1;
+  }
+  return sample_level(0, min, sample_gain(min, max));
+}
+
+// the minimum and maximum of `input` in a single pass
+static std::pair<float, float> value_range(const nn::Tensor<float, 3> &input) {
+  const float *data = &input(0, 0, 0);
+  const size_t size = input.size();
+
+  float min = data[0];
+  float max = data[0];
+  for (size_t i = 1; i < size; i++) {
+    min = std::min(min, data[i]);
+    max = std::max(max, data[i]);
+  }
+  return {min, max};
+}
+
+// The factor the transform of `dct_method` leaves coefficient (row, col)
+// of a `width` wide block scaled by (forward) or wants it scaled by
+// (inverse), relative to the orthonormal DCT (the JPEG normalization
+// ISLOW uses for 8x8 blocks).
+static float coefficient_scale(const int32_t dct_method, const bool inverse,
+                               const int width, const int row,
+                               const int col) {
+  if (dct_method == FLOAT_DCT) {
+    // codec::utils normalizes the forward transform by 1 / (4 N^2) and
+    // leaves the inverse alone, which works out to the same factor of
+    // 1 / sqrt(N) for the first and 1 / sqrt(2 N) for the other
+    // coefficients in each dimension either way
+    const float dc_scale = 1 / std::sqrt(static_cast<float>(width));
+    const float ac_scale = 1 / std::sqrt(2.f * width);
+    return (row == 0 ? dc_scale : ac_scale) * (col == 0 ? dc_scale : ac_scale);
+  }
+
+  const codec::DCTMethod method = static_cast<codec::DCTMethod>(dct_method);
+  return inverse
+             ? codec::FastIDCT::coefficient_scale(method, 8 * row + col)
+             : codec::FastDCT::coefficient_scale(method, 8 * row + col);
+}
+
+// What coefficient i (in zigzag order) of a `dct_method` block gets
+// divided by (forward) or multiplied by (inverse) to (de)quantize it. The
+// DCT is orthonormal, so the same steps give the same error for every
+// block size, and 4x4 blocks use those of 8x8 blocks. The coefficients
+// grow with N, though, and those of 16x16 blocks only fit the alphabet
+// with twice the steps, which doubles the error: that is the price of
+// the larger blocks.
+static void quantization_steps(const float scale, const int32_t dct_method,
+                               const bool inverse, const BlockShape &shape,
+                               float *steps) {
+  const float size_scale =
+      std::max(1.f, static_cast<float>(shape.width) / BLOCK_WIDTH);
+
+  for (int i = 0; i < shape.length; i++) {
+    const float scalef = std::max(1.f, scale * shape.quantization[i]);
+    steps[i] = scalef * size_scale *
+               coefficient_scale(dct_method, inverse, shape.width,
+                                 shape.zigzag_order[i][0],
+                                 shape.zigzag_order[i][1]);
+  }
+}
+
+// `dim` rounded up to a whole number of `width` wide blocks
+static uint64_t padded_size(const uint64_t dim, const int width) {
+  return (dim + width - 1) / width * width;
+}
 
-  // auto quantize_t1 = std::chrono::high_resolution_clock::now();
+// quantizes `t_input` to 8-bits into the workspace's samples and flags
+// every `width` wide block that is all zero in its zero_blocks, one flag
+// per block, in coding order. Returns the samples, which are padded to
+// whole blocks by repeating the last row and column, so the padding
+// costs (next to) no coefficients and the decoder can crop it off.
+static nn::Tensor<int16_t, 3> forward_transform(
+    const nn::Tensor<float, 3> t_input, const float min, const float max,
+    const int width, Workspace &workspace) {
+  const uint64_t dim0 = t_input.dimension(0);
+  const uint64_t input_rows = t_input.dimension(1);
+  const uint64_t input_cols = t_input.dimension(2);
+  const uint64_t dim1 = padded_size(input_rows, width);
+  const uint64_t dim2 = padded_size(input_cols, width);
 
-  // quantize to 8-bits
-  Eigen::Tensor<float, 3, Eigen::RowMajor> q1_input =
-      (255.f * (t_input.tensor() - min)) / range;
-  // Eigen::Tensor<float, 3, Eigen::RowMajor> q1_input =
-  //     (127.f * (t_input.tensor() - min)) / range;
-  // Eigen::Tensor<float, 3, Eigen::RowMajor> q1_input = (63.f *
-  // (t_input.tensor() - min)) / range - 32.f;
-  nn::Tensor<float, 3> q_input(q1_input);
+  const float gain = sample_gain(min, max);
 
-  nn::Tensor<int16_t, 3> dct_in(q_input.dimension(0), q_input.dimension(1),
-                                q_input.dimension(2));
+  workspace.samples.resize(dim0 * dim1 * dim2);
+  nn::Tensor<int16_t, 3> samples(workspace.samples.data(), dim0, dim1, dim2);
 
-  // round to nearest
+  // quantize to 8-bits, rounding to nearest
   for (size_t channel = 0; channel < dim0; channel++) {
-    for (size_t row = 0; row < dim1; row++) {
-      for (size_t col = 0; col < dim2; col++) {
-        const float value = std::round(q_input(channel, row, col));
-        dct_in(channel, row, col) = static_cast<int16_t>(value);
+    for (size_t row = 0; row < input_rows; row++) {
+      const float *input_row = &t_input(channel, row, 0);
+      int16_t *sample_row = &samples(channel, row, 0);
+      for (size_t col = 0; col < input_cols; col++) {
+        sample_row[col] = sample_level(input_row[col], min, gain);
       }
+      std::fill(sample_row + input_cols, sample_row + dim2,
+                sample_row[input_cols - 1]);
+    }
+
+    const int16_t *last_row = &samples(channel, input_rows - 1, 0);
+    for (size_t row = input_rows; row < dim1; row++) {
+      std::copy(last_row, last_row + dim2, &samples(channel, row, 0));
     }
   }
-  // auto quantize_t2 = std::chrono::high_resolution_clock::now();
-  // std::cout << "quantize time: "
-            // << std::chrono::duration_cast<std::chrono::duration<double>>(
-            //        quantize_t2 - quantize_t1)
-            //        .count()
-            // << std::endl;
-
-  // do the dct
-  // nn::Tensor<int16_t, 3> dct_out(dct_in);
-  codec::FastDCT dct;
-  // auto dct_t1 = std::chrono::high_resolution_clock::now();
-  nn::Tensor<int16_t, 3> dct_out = dct(dct_in);
-  // auto dct_t2 = std::chrono::high_resolution_clock::now();
-  // std::cout << "dct time: "
-            // << std::chrono::duration_cast<std::chrono::duration<double>>(
-            //        dct_t2 - dct_t1)
-            //        .count()
-            // << std::endl;
-
-  assert(quality_ > 0);
-  assert(quality_ <= 100);
-  const float scale = quality_ < 50 ? 50.f / quality_ : (100.f - quality_) / 50;
-
-  // codec::DummyArithmeticEncoder encoder;
-  /*  codec::ArithmeticEncoder<codec::SimpleAdaptiveModel> encoder(     \
-   "{\"denominator\":32899,\"num_symbols\":128,\"sym_0_lower\":0,\"sym_0_upper\":1,\"sym_100_lower\":32868,\"sym_100_upper\":32869,\"sym_101_lower\":32869,\"sym_101_upper\":32870,\"sym_102_lower\":32870,\"sym_102_upper\":32871,\"sym_103_lower\":32871,\"sym_103_upper\":32872,\"sym_104_lower\":32872,\"sym_104_upper\":32873,\"sym_105_lower\":32873,\"sym_105_upper\":32874,\"sym_106_lower\":32874,\"sym_106_upper\":32875,\"sym_107_lower\":32875,\"sym_107_upper\":32876,\"sym_108_lower\":32876,\"sym_108_upper\":32877,\"sym_109_lower\":32877,\"sym_109_upper\":32878,\"sym_10_lower\":10,\"sym_10_upper\":11,\"sym_110_lower\":32878,\"sym_110_upper\":32879,\"sym_111_lower\":32879,\"sym_111_upper\":32880,\"sym_112_lower\":32880,\"sym_112_upper\":32881,\"sym_113_lower\":32881,\"sym_113_upper\":32882,\"sym_114_lower\":32882,\"sym_114_upper\":32883,\"sym_115_lower\":32883,\"sym_115_upper\":32884,\"sym_116_lower\":32884,\"sym_116_upper\":32885,\"sym_117_lower\":32885,\"sym_117_upper\":32886,\"sym_118_lower\":32886,\"sym_118_upper\":32887,\"sym_119_lower\":32887,\"sym_119_upper\":32888,\"sym_11_lower\":11,\"sym_11_upper\":12,\"sym_120_lower\":32888,\"sym_120_upper\":32889,\"sym_121_lower\":32889,\"sym_121_upper\":32890,\"sym_122_lower\":32890,\"sym_122_upper\":32891,\"sym_123_lower\":32891,\"sym_123_upper\":32892,\"sym_124_lower\":32892,\"sym_124_upper\":32893,\"sym_125_lower\":32893,\"sym_125_upper\":32894,\"sym_126_lower\":32894,\"sym_126_upper\":32895,\"sym_127_lower\":32895,\"sym_127_upper\":32896,\"sym_12_lower\":12,\"sym_12_upper\":13,\"sym_13_lower\":13,\"sym_13_upper\":14,\"sym_14_lower\":14,\"sym_14_upper\":15,\"sym_15_lower\":15,\"sym_15_upper\":16,\"sym_16_lower\":16,\"sym_16_upper\":17,\"sym_17_lower\":17,\"sym_17_upper\":18,\"sym_18_lower\":18,\"sym_18_upper\":19,\"sym_19_lower\":19,\"sym_19_upper\":20,\"sym_1_lower\":1,\"sym_1_upper\":2,\"sym_20_lower\":20,\"sym_20_upper\":21,\"sym_21_lower\":21,\"sym_21_upper\":22,\"sym_22_lower\":22,\"sym_22_upper\":23,\"sym_23_lower\":23,\"sym_23_upper\":24,\"sym_24_lower\":24,\"sym_24_upper\":25,\"sym_25_lower\":25,\"sym_25_upper\":26,\"sym_26_lower\":26,\"sym_26_upper\":27,\"sym_27_lower\":27,\"sym_27_upper\":28,\"sym_28_lower\":28,\"sym_28_upper\":29,\"sym_29_lower\":29,\"sym_29_upper\":30,\"sym_2_lower\":2,\"sym_2_upper\":3,\"sym_30_lower\":30,\"sym_30_upper\":31,\"sym_31_lower\":31,\"sym_31_upper\":32,\"sym_32_lower\":32,\"sym_32_upper\":33,\"sym_33_lower\":33,\"sym_33_upper\":34,\"sym_34_lower\":34,\"sym_34_upper\":35,\"sym_35_lower\":35,\"sym_35_upper\":36,\"sym_36_lower\":36,\"sym_36_upper\":37,\"sym_37_lower\":37,\"sym_37_upper\":38,\"sym_38_lower\":38,\"sym_38_upper\":39,\"sym_39_lower\":39,\"sym_39_upper\":40,\"sym_3_lower\":3,\"sym_3_upper\":4,\"sym_40_lower\":40,\"sym_40_upper\":41,\"sym_41_lower\":41,\"sym_41_upper\":43,\"sym_42_lower\":43,\"sym_42_upper\":44,\"sym_43_lower\":44,\"sym_43_upper\":47,\"sym_44_lower\":47,\"sym_44_upper\":50,\"sym_45_lower\":50,\"sym_45_upper\":52,\"sym_46_lower\":52,\"sym_46_upper\":54,\"sym_47_lower\":54,\"sym_47_upper\":61,\"sym_48_lower\":61,\"sym_48_upper\":70,\"sym_49_lower\":70,\"sym_49_upper\":77,\"sym_4_lower\":4,\"sym_4_upper\":5,\"sym_50_lower\":77,\"sym_50_upper\":90,\"sym_51_lower\":90,\"sym_51_upper\":104,\"sym_52_lower\":104,\"sym_52_upper\":125,\"sym_53_lower\":125,\"sym_53_upper\":142,\"sym_54_lower\":142,\"sym_54_upper\":171,\"sym_55_lower\":171,\"sym_55_upper\":216,\"sym_56_lower\":216,\"sym_56_upper\":266,\"sym_57_lower\":266,\"sym_57_upper\":335,\"sym_58_lower\":335,\"sym_58_upper\":416,\"sym_59_lower\":416,\"sym_59_upper\":572,\"sym_5_lower\":5,\"sym_5_upper\":6,\"sym_60_lower\":572,\"sym_60_upper\":792,\"sym_61_lower\":792,\"sym_61_upper\":1167,\"sym_62_lower\":1167,\"sym_62_upper\":1950,\"sym_63_lower\":1950,\"sym_63_upper\":4265,\"sym_64_lower\":4265,\"sym_64_upper\":28851,\"sym_65_lower\":28851,\"sym_65_upper\":31167,\"sym_66_lower\":31167,\"sym_66_upper\":31950,\"sym_67_lower\":31950,\"sym_67_upper\":32294,\"sym_68_lower\":32294,\"sym_68_upper\":32483,\"sym_69_lower\":32483,\"sym_69_upper\":32609,\"sym_6_lower\":6,\"sym_6_upper\":7,\"sym_70_lower\":32609,\"sym_70_upper\":32670,\"sym_71_lower\":32670,\"sym_71_upper\":32720,\"sym_72_lower\":32720,\"sym_72_upper\":32761,\"sym_73_lower\":32761,\"sym_73_upper\":32782,\"sym_74_lower\":32782,\"sym_74_upper\":32804,\"sym_75_lower\":32804,\"sym_75_upper\":32810,\"sym_76_lower\":32810,\"sym_76_upper\":32815,\"sym_77_lower\":32815,\"sym_77_upper\":32825,\"sym_78_lower\":32825,\"sym_78_upper\":32832,\"sym_79_lower\":32832,\"sym_79_upper\":32837,\"sym_7_lower\":7,\"sym_7_upper\":8,\"sym_80_lower\":32837,\"sym_80_upper\":32840,\"sym_81_lower\":32840,\"sym_81_upper\":32844,\"sym_82_lower\":32844,\"sym_82_upper\":32847,\"sym_83_lower\":32847,\"sym_83_upper\":32849,\"sym_84_lower\":32849,\"sym_84_upper\":32850,\"sym_85_lower\":32850,\"sym_85_upper\":32852,\"sym_86_lower\":32852,\"sym_86_upper\":32854,\"sym_87_lower\":32854,\"sym_87_upper\":32856,\"sym_88_lower\":32856,\"sym_88_upper\":32857,\"sym_89_lower\":32857,\"sym_89_upper\":32858,\"sym_8_lower\":8,\"sym_8_upper\":9,\"sym_90_lower\":32858,\"sym_90_upper\":32859,\"sym_91_lower\":32859,\"sym_91_upper\":32860,\"sym_92_lower\":32860,\"sym_92_upper\":32861,\"sym_93_lower\":32861,\"sym_93_upper\":32862,\"sym_94_lower\":32862,\"sym_94_upper\":32863,\"sym_95_lower\":32863,\"sym_95_upper\":32864,\"sym_96_lower\":32864,\"sym_96_upper\":32865,\"sym_97_lower\":32865,\"sym_97_upper\":32866,\"sym_98_lower\":32866,\"sym_98_upper\":32867,\"sym_99_lower\":32867,\"sym_99_upper\":32868,\"sym_9_lower\":9,\"sym_9_upper\":10,\"sym_end_lower\":32896,\"sym_end_upper\":32898}" \
-   ); */
-  codec::ArithmeticEncoder<codec::SimpleAdaptiveModel> encoder(DCT_MAX - \
-                                                               DCT_MIN + 1);
-
-  // arithmetic encode and serialize data
-  // auto encode_t1 = std::chrono::high_resolution_clock::now();
+
+  // find the blocks that carry no data
+  const int16_t zero = zero_level(min, max);
+
+  std::vector<uint8_t> &zero_blocks = workspace.zero_blocks;
+  zero_blocks.clear();
+  zero_blocks.reserve(dim0 * (dim1 / width) * (dim2 / width));
+
   for (size_t channel = 0; channel < dim0; channel++) {
-    for (size_t block_row = 0; block_row < dim1 / BLOCK_WIDTH; block_row++) {
-      for (size_t block_col = 0; block_col < dim2 / BLOCK_WIDTH; block_col++) {
-        for (size_t i = 0; i < ZIGZAG_LENGTH; i++) {
-          const size_t row_offset =
-              BLOCK_WIDTH * block_row + ZIGZAG_ORDER[i][0];
-          const size_t col_offset =
-              BLOCK_WIDTH * block_col + ZIGZAG_ORDER[i][1];
-
-          float scalef = scale * JPEG_QUANTIZATION[i];
-          if (scalef < 1) {
-            scalef = 1;
+    for (size_t row_offset = 0; row_offset < dim1; row_offset += width) {
+      for (size_t col_offset = 0; col_offset < dim2; col_offset += width) {
+        bool zero_block = true;
+        for (int row = 0; zero_block and row < width; row++) {
+          for (int col = 0; col < width; col++) {
+            if (samples(channel, row_offset + row, col_offset + col) != zero) {
+              zero_block = false;
+              break;
+            }
           }
-          const float valf =
-              static_cast<float>(dct_out(channel, row_offset, col_offset));
-          const int32_t element =
-              static_cast<int32_t>(std::round(valf / scalef));
+        }
 
-          assert(element >= DCT_MIN);
-          assert(element < DCT_MAX);
+        zero_blocks.push_back(zero_block);
+      }
+    }
+  }
 
-          const int symbol = element - DCT_MIN;
-          assert(symbol >= 0);
-          assert(symbol < (DCT_MAX - DCT_MIN + 1));
+  return samples;
+}
+
+// the reciprocals of `steps` (in zigzag order) in raster order, so
+// quantize_block can multiply along the rows of a block
+static void quantization_reciprocals(const BlockShape &shape,
+                                     const float *steps, float *reciprocals) {
+  for (int i = 0; i < shape.length; i++) {
+    reciprocals[shape.width * shape.zigzag_order[i][0] +
+                shape.zigzag_order[i][1]] = 1.f / steps[i];
+  }
+}
+
+// Quantizes the coefficients of a `shape` block (with rows `stride`
+// apart) by the `reciprocals` of its steps into `elements`, in zigzag
+// order, saturated to [DCT_MIN, DCT_MAX]. Returns the number of
+// coefficients up to and including the last non-zero one.
+template <typename T>
+static int quantize_block(const T *coefficients, const size_t stride,
+                          const BlockShape &shape, const float *reciprocals,
+                          int32_t *elements) {
+  const int width = shape.width;
+
+  // quantize along the rows, which vectorizes, then reorder
+  int32_t levels[MAX_BLOCK_LENGTH];
+  for (int row = 0; row < width; row++) {
+    const T *coefficient_row = coefficients + stride * row;
+    const float *reciprocal_row = reciprocals + width * row;
+    int32_t *level_row = levels + width * row;
+    for (int col = 0; col < width; col++) {
+      level_row[col] = round_to_int(static_cast<float>(coefficient_row[col]) *
+                                    reciprocal_row[col]);
+    }
+  }
 
-          encoder.encode_symbol(static_cast<uint32_t>(symbol));
+  int length = 0;
+
+  for (int i = 0; i < shape.length; i++) {
+    // a level outside of the alphabet would run past the probability
+    // models or alias the control symbols. Only blocks with sharp edges
+    // of nearly the full range get there, so saturate them.
+    const int32_t element = std::min(
+        std::max(levels[width * shape.zigzag_order[i][0] +
+                        shape.zigzag_order[i][1]],
+                 DCT_MIN),
+        DCT_MAX);
+
+    elements[i] = element;
+    if (element != 0) {
+      length = i + 1;
+    }
+  }
+
+  return length;
+}
+
+// Transforms the 8-bit `samples` (with the zero block flags of
+// `workspace`) and hands every block to `code_block`, in coding order, as
+// its quantized coefficients in zigzag order along with the number of
+// coefficients up to and including the last non-zero one (or -1 for a
+// zero block). The integer dcts (8x8 only) go one row of blocks at a
+// time, so the coefficients never leave the cache between the dct and
+// the coder; the float dct transforms all of `samples` at once.
+template <class BlockFunc>
+static void for_each_block(const nn::Tensor<int16_t, 3> &samples,
+                           Workspace &workspace, const float scale,
+                           const int32_t dct_method, const BlockShape &shape,
+                           BlockFunc code_block) {
+  const uint64_t dim0 = samples.dimension(0);
+  const uint64_t dim1 = samples.dimension(1);
+  const uint64_t dim2 = samples.dimension(2);
+  const int width = shape.width;
+
+  float steps[MAX_BLOCK_LENGTH];
+  quantization_steps(scale, dct_method, false, shape, steps);
+  float reciprocals[MAX_BLOCK_LENGTH];
+  quantization_reciprocals(shape, steps, reciprocals);
+
+  const std::vector<uint8_t> &zero_blocks = workspace.zero_blocks;
+  int32_t elements[MAX_BLOCK_LENGTH];
+  size_t block = 0;
+
+  if (dct_method == FLOAT_DCT) {
+    workspace.float_buffer.resize(dim0 * dim1 * dim2);
+    nn::Tensor<float, 3> shifted(workspace.float_buffer.data(), dim0, dim1,
+                                 dim2);
+    for (size_t channel = 0; channel < dim0; channel++) {
+      for (size_t row = 0; row < dim1; row++) {
+        for (size_t col = 0; col < dim2; col++) {
+          shifted(channel, row, col) = samples(channel, row, col) - 128.f;
+        }
+      }
+    }
+
+    const nn::Tensor<float, 3> coefficients =
+        codec::utils::dct(shifted, width);
+
+    for (size_t channel = 0; channel < dim0; channel++) {
+      for (size_t row_offset = 0; row_offset < dim1; row_offset += width) {
+        for (size_t col_offset = 0; col_offset < dim2; col_offset += width) {
+          if (zero_blocks[block++]) {
+            code_block(elements, -1);
+            continue;
+          }
+
+          code_block(elements,
+                     quantize_block(&coefficients(channel, row_offset,
+                                                  col_offset),
+                                    dim2, shape, reciprocals, elements));
         }
       }
     }
+    return;
   }
-  // auto encode_t2 = std::chrono::high_resolution_clock::now();
-  // std::cout << "encode time: "
-            // << std::chrono::duration_cast<std::chrono::duration<double>>(
-            //        encode_t2 - encode_t1)
-            //        .count()
-            // << std::endl;
-
-  std::vector<char> encoding = encoder.finish();
-  //std::cout << encoder.dump_model() << std::endl;
-  
-  // auto serialize_t1 = std::chrono::high_resolution_clock::now();
-  // add footer
-  {
-    uint64_t dim0_ = dim0;
-    uint64_t dim1_ = dim1;
-    uint64_t dim2_ = dim2;
-    char *dim0_bytes = reinterpret_cast<char *>(&dim0_);
-    char *dim1_bytes = reinterpret_cast<char *>(&dim1_);
-    char *dim2_bytes = reinterpret_cast<char *>(&dim2_);
-    for (size_t i = 0; i < sizeof(uint64_t); i++) {
-      encoding.push_back(dim0_bytes[i]);
+
+  assert(width == BLOCK_WIDTH);
+  const uint64_t blocks_per_row = dim2 / BLOCK_WIDTH;
+
+  const codec::FastDCT &dct =
+      dct_method == IFAST_DCT ? workspace.ifast_dct : workspace.islow_dct;
+  std::vector<int16_t> &row_coefficients = workspace.coefficients;
+  row_coefficients.resize(blocks_per_row * ZIGZAG_LENGTH);
+
+  for (size_t channel = 0; channel < dim0; channel++) {
+    for (size_t row_offset = 0; row_offset < dim1; row_offset += BLOCK_WIDTH) {
+      const uint8_t *row_zero_blocks = &zero_blocks[block];
+
+      // runs of adjacent data blocks are transformed together so the
+      // wider dct kernels can batch them
+      for (size_t block_col = 0; block_col < blocks_per_row;) {
+        if (row_zero_blocks[block_col]) {
+          block_col++;
+          continue;
+        }
+
+        size_t run_end = block_col + 1;
+        while (run_end < blocks_per_row and not row_zero_blocks[run_end]) {
+          run_end++;
+        }
+
+        dct.dct_plane(&samples(channel, row_offset, BLOCK_WIDTH * block_col),
+                      dim2, run_end - block_col,
+                      &row_coefficients[block_col * ZIGZAG_LENGTH]);
+        block_col = run_end;
+      }
+
+      for (size_t block_col = 0; block_col < blocks_per_row; block_col++) {
+        if (zero_blocks[block++]) {
+          code_block(elements, -1);
+          continue;
+        }
+
+        code_block(elements,
+                   quantize_block(&row_coefficients[block_col * ZIGZAG_LENGTH],
+                                  BLOCK_WIDTH, shape, reciprocals, elements));
+      }
+    }
+  }
+}
+
+// Hands the symbols of the multi-symbol alphabet to `emit_symbol`. Zero
+// blocks become a single ZERO_BLOCK symbol and trailing zero
+// coefficients a single EOB symbol.
+template <class SymbolFunc>
+static void emit_symbols(const nn::Tensor<int16_t, 3> &samples,
+                         Workspace &workspace, const float scale,
+                         const int32_t dct_method, const BlockShape &shape,
+                         SymbolFunc emit_symbol) {
+  for_each_block(
+      samples, workspace, scale, dct_method, shape,
+      [&emit_symbol, &shape](const int32_t *elements, const int length) {
+        if (length < 0) {
+          emit_symbol(ZERO_BLOCK_SYMBOL);
+          return;
+        }
+
+        for (int i = 0; i < length; i++) {
+          const int symbol = elements[i] - DCT_MIN;
+          assert(symbol >= 0);
+          assert(symbol < (DCT_MAX - DCT_MIN + 1));
+
+          emit_symbol(static_cast<uint32_t>(symbol));
+        }
+        if (length < shape.length) {
+          emit_symbol(EOB_SYMBOL);
+        }
+      });
+}
+
+// Reads one block of `block_length` coefficients of the multi-symbol
+// alphabet into `elements`. Returns the number of coefficients read, or
+// -1 for a zero block.
+template <class Decoder>
+static int read_symbols(Decoder &decoder, const int block_length,
+                        int32_t *elements) {
+  uint32_t symbol = decoder.decode_symbol();
+  if (symbol == ZERO_BLOCK_SYMBOL) {
+    return -1;
+  }
+
+  int length = 0;
+  for (; length < block_length; length++) {
+    if (length > 0) {
+      symbol = decoder.decode_symbol();
     }
-    for (size_t i = 0; i < sizeof(uint64_t); i++) {
-      encoding.push_back(dim1_bytes[i]);
+    if (symbol == EOB_SYMBOL) {
+      break;
     }
-    for (size_t i = 0; i < sizeof(uint64_t); i++) {
-      encoding.push_back(dim2_bytes[i]);
+    if (symbol > EOB_SYMBOL) {
+      throw std::runtime_error("nnfc2 unexpected symbol in block");
     }
+
+    elements[length] = static_cast<int32_t>(symbol) + DCT_MIN;
+  }
+
+  return length;
+}
+
+// Binarization of the coefficients for the binary entropy coder. A block
+// is coded as a zero-block flag, a coded-block flag and then, in zigzag
+// order, a significance flag per coefficient and a last flag after every
+// significant one (as in H.264's CABAC). Every significant coefficient
+// gets a greater-than-one flag, an Exp-Golomb coded remainder if it is
+// greater than one and a bypass coded sign.
+static constexpr int NUM_FREQUENCY_BANDS = 4;
+static constexpr int NUM_REMAINDER_CONTEXTS = 5;
+
+// the first 15 zigzag positions hold most of the energy, so they get
+// contexts of their own for the level bins
+static int frequency_band(const int i) {
+  if (i == 0) {
+    return 0;
   }
+  return i < 6 ? 1 : (i < 15 ? 2 : 3);
+}
 
-  // add min and max to footer
-  {
-    float min_ = min;
-    float max_ = max;
-    char *min_bytes = reinterpret_cast<char *>(&min_);
-    char *max_bytes = reinterpret_cast<char *>(&max_);
-    for (size_t i = 0; i < sizeof(float); i++) {
-      encoding.push_back(min_bytes[i]);
+struct CoefficientContexts {
+  CoefficientContexts(const int block_length)
+      : block_length(block_length),
+        zero_block(),
+        coded_block(),
+        significant(),
+        last(),
+        greater_than_one(),
+        remainder() {}
+
+  // the number of coefficients in a block
+  const int block_length;
+
+  codec::BinaryContext zero_block;
+  codec::BinaryContext coded_block;
+  codec::BinaryContext significant[MAX_BLOCK_LENGTH];
+  codec::BinaryContext last[MAX_BLOCK_LENGTH];
+  codec::BinaryContext greater_than_one[NUM_FREQUENCY_BANDS];
+  codec::BinaryContext remainder[NUM_FREQUENCY_BANDS][NUM_REMAINDER_CONTEXTS];
+};
+
+static void encode_bins(codec::BinaryArithmeticEncoder &encoder,
+                        CoefficientContexts &contexts,
+                        const int32_t *elements, const int length) {
+  encoder.encode_bit(contexts.zero_block, length < 0);
+  if (length < 0) {
+    return;
+  }
+
+  encoder.encode_bit(contexts.coded_block, length > 0);
+
+  for (int i = 0; i < length; i++) {
+    const uint32_t significant = elements[i] != 0;
+
+    // the last coefficient of the alphabet is significant if reached
+    if (i < contexts.block_length - 1) {
+      encoder.encode_bit(contexts.significant[i], significant);
+      if (not significant) {
+        continue;
+      }
+      encoder.encode_bit(contexts.last[i], i == length - 1);
     }
-    for (size_t i = 0; i < sizeof(float); i++) {
-      encoding.push_back(max_bytes[i]);
+
+    const int band = frequency_band(i);
+    const uint32_t magnitude = std::abs(elements[i]);
+
+    encoder.encode_bit(contexts.greater_than_one[band], magnitude > 1);
+    if (magnitude > 1) {
+      // zeroth order Exp-Golomb code of `magnitude - 2`
+      uint32_t remainder = magnitude - 2;
+      int prefix = 0;
+      while (remainder >= (1u << prefix)) {
+        remainder -= 1u << prefix;
+        encoder.encode_bit(
+            contexts.remainder[band]
+                              [std::min(prefix, NUM_REMAINDER_CONTEXTS - 1)],
+            1);
+        prefix++;
+      }
+      encoder.encode_bit(
+          contexts.remainder[band]
+                            [std::min(prefix, NUM_REMAINDER_CONTEXTS - 1)],
+          0);
+      encoder.encode_bypass_bits(remainder, prefix);
     }
+
+    encoder.encode_bypass(elements[i] < 0);
+  }
+}
+
+// Reads one binarized block into `elements`. Returns the number of
+// coefficients read, or -1 for a zero block.
+static int decode_bins(codec::BinaryArithmeticDecoder &decoder,
+                       CoefficientContexts &contexts, int32_t *elements) {
+  if (decoder.decode_bit(contexts.zero_block)) {
+    return -1;
+  }
+  if (not decoder.decode_bit(contexts.coded_block)) {
+    return 0;
   }
 
-  // add quality to footer
-  {
-    int32_t quality = quality_;
-    char *quality_bytes = reinterpret_cast<char *>(&quality);
-    for (size_t i = 0; i < sizeof(int32_t); i++) {
-      encoding.push_back(quality_bytes[i]);
+  for (int i = 0; i < contexts.block_length; i++) {
+    bool last = i == contexts.block_length - 1;
+    if (not last) {
+      if (not decoder.decode_bit(contexts.significant[i])) {
+        elements[i] = 0;
+        continue;
+      }
+      last = decoder.decode_bit(contexts.last[i]);
+    }
+
+    const int band = frequency_band(i);
+    int32_t magnitude = 1;
+
+    if (decoder.decode_bit(contexts.greater_than_one[band])) {
+      int prefix = 0;
+      int32_t remainder = 0;
+      while (decoder.decode_bit(
+          contexts.remainder[band]
+                            [std::min(prefix, NUM_REMAINDER_CONTEXTS - 1)])) {
+        remainder += 1 << prefix;
+        prefix++;
+        if (prefix > 8) {
+          throw std::runtime_error("nnfc2 coefficient remainder too long");
+        }
+      }
+      remainder += decoder.decode_bypass_bits(prefix);
+      magnitude = remainder + 2;
+    }
+
+    elements[i] = decoder.decode_bypass() ? -magnitude : magnitude;
+
+    if (last) {
+      return i + 1;
     }
   }
 
-  std::vector<uint8_t> encoding_(
-      reinterpret_cast<uint8_t *>(encoding.data()),
-      reinterpret_cast<uint8_t *>(encoding.data()) + encoding.size());
+  throw std::runtime_error("nnfc2 block without a last coefficient");
+}
 
-  // auto serialize_t2 = std::chrono::high_resolution_clock::now();
-  // std::cout << "serialize time: "
-            // << std::chrono::duration_cast<std::chrono::duration<double>>(
-            //        serialize_t2 - serialize_t1)
-            //        .count()
-            // << std::endl;
+// Dequantizes the first `length` coefficients of `elements` (in the
+// zigzag order of `shape`) by `steps` into a block with rows `stride`
+// apart. The others are zero.
+template <typename T>
+static void dequantize_block(const int32_t *elements, const int length,
+                             const BlockShape &shape, const float *steps,
+                             T *coefficients, const size_t stride) {
+  for (int row = 0; row < shape.width; row++) {
+    std::fill_n(coefficients + stride * row, shape.width, 0);
+  }
 
-  return encoding_;
+  for (int i = 0; i < length; i++) {
+    const float value = steps[i] * elements[i];
+    T &coefficient = coefficients[stride * shape.zigzag_order[i][0] +
+                                  shape.zigzag_order[i][1]];
+    if constexpr (std::is_integral<T>::value) {
+      coefficient = std::round(value);
+    } else {
+      coefficient = value;
+    }
+  }
 }
 
-nn::Tensor<float, 3> nnfc::NNFC2Encoder::backward(
-    const nn::Tensor<float, 3> input) const {
-  return input;
+// the level a block that `read_block` returned `length` for is flat at,
+// or -1 if it needs the IDCT
+static int flat_level(const int length, const int16_t zero) {
+  if (length > 0) {
+    return -1;
+  }
+
+  // a zero block is flat at the level zero quantized to and a block
+  // without coefficients is flat at the DCT level shift
+  if (length < 0 and zero < 0) {
+    throw std::runtime_error("nnfc2 zero block out of range");
+  }
+  return length < 0 ? zero : 128;
 }
 
-nnfc::NNFC2Decoder::NNFC2Decoder() {}
+static void fill_block(nn::Tensor<uint8_t, 3> &output, const size_t channel,
+                       const size_t row_offset, const size_t col_offset,
+                       const int width, const uint8_t level) {
+  for (int row = 0; row < width; row++) {
+    std::fill_n(&output(channel, row_offset + row, col_offset), width, level);
+  }
+}
 
-nnfc::NNFC2Decoder::~NNFC2Decoder() {}
+// inverse_transform for FLOAT_DCT, which has to see all of `channels` at
+// once
+template <class BlockReader>
+static void float_inverse_transform(
+    BlockReader read_block, const std::pair<uint64_t, uint64_t> channels,
+    const uint64_t dim1, const uint64_t dim2, const BlockShape &shape,
+    const float *steps, const int16_t zero, SampleWriter &writer,
+    Workspace &workspace) {
+  const uint64_t dim0 = channels.second - channels.first;
+  const int width = shape.width;
 
-nn::Tensor<float, 3> nnfc::NNFC2Decoder::forward(
-    const std::vector<uint8_t> input) const {
-  const size_t input_size = input.size();
+  workspace.float_buffer.resize(dim0 * dim1 * dim2);
+  nn::Tensor<float, 3> coefficients(workspace.float_buffer.data(), dim0, dim1,
+                                    dim2);
+
+  // the level of every block, or -1 for the ones the IDCT fills in
+  std::vector<int16_t> &levels = workspace.block_levels;
+  levels.clear();
 
-  // read dims from footer
-  uint64_t dim0;
-  uint64_t dim1;
-  uint64_t dim2;
-  {
-    uint8_t *dim0_bytes = reinterpret_cast<uint8_t *>(&dim0);
-    uint8_t *dim1_bytes = reinterpret_cast<uint8_t *>(&dim1);
-    uint8_t *dim2_bytes = reinterpret_cast<uint8_t *>(&dim2);
-
-    const size_t dim0_offset = input_size - 3 * sizeof(uint64_t) -
-                               2 * sizeof(float) - 1 * sizeof(int32_t);
-    const size_t dim1_offset = input_size - 2 * sizeof(uint64_t) -
-                               2 * sizeof(float) - 1 * sizeof(int32_t);
-    const size_t dim2_offset = input_size - 1 * sizeof(uint64_t) -
-                               2 * sizeof(float) - 1 * sizeof(int32_t);
-    for (size_t i = 0; i < sizeof(uint64_t); i++) {
-      dim0_bytes[i] = input[i + dim0_offset];
-      dim1_bytes[i] = input[i + dim1_offset];
-      dim2_bytes[i] = input[i + dim2_offset];
+  int32_t elements[MAX_BLOCK_LENGTH];
+
+  for (size_t channel = 0; channel < dim0; channel++) {
+    for (size_t row_offset = 0; row_offset < dim1; row_offset += width) {
+      for (size_t col_offset = 0; col_offset < dim2; col_offset += width) {
+        const int length = read_block(elements);
+        levels.push_back(flat_level(length, zero));
+
+        dequantize_block(elements, std::max(length, 0), shape, steps,
+                         &coefficients(channel, row_offset, col_offset),
+                         dim2);
+      }
     }
   }
 
-  // read min and max from header
-  float min;
-  float max;
-  {
-    uint8_t *min_bytes = reinterpret_cast<uint8_t *>(&min);
-    uint8_t *max_bytes = reinterpret_cast<uint8_t *>(&max);
-
-    const size_t min_offset =
-        input_size - 2 * sizeof(float) - 1 * sizeof(int32_t);
-    const size_t max_offset =
-        input_size - 1 * sizeof(float) - 1 * sizeof(int32_t);
-    for (size_t i = 0; i < sizeof(float); i++) {
-      min_bytes[i] = input[i + min_offset];
-    }
-    for (size_t i = 0; i < sizeof(float); i++) {
-      max_bytes[i] = input[i + max_offset];
+  const nn::Tensor<float, 3> samples =
+      codec::utils::idct(coefficients, width);
+
+  workspace.band.resize(width * dim2);
+  nn::Tensor<uint8_t, 3> band(workspace.band.data(), 1, width, dim2);
+
+  size_t block = 0;
+  for (size_t channel = 0; channel < dim0; channel++) {
+    for (size_t row_offset = 0; row_offset < dim1; row_offset += width) {
+      for (size_t col_offset = 0; col_offset < dim2; col_offset += width) {
+        const int level = levels[block++];
+        if (level >= 0) {
+          fill_block(band, 0, 0, col_offset, width, level);
+          continue;
+        }
+
+        for (int row = 0; row < width; row++) {
+          const float *sample_row = &samples(channel, row_offset + row, 0);
+          for (size_t col = col_offset; col < col_offset + width; col++) {
+            const float value = std::round(sample_row[col] + 128);
+            band(0, row, col) =
+                static_cast<uint8_t>(std::min(255.f, std::max(0.f, value)));
+          }
+        }
+      }
+
+      writer.write_band(band, channels.first + channel, row_offset);
     }
   }
-  const float range = max - min;
+}
+
+// Reads every block of `channels` with `read_block` (see read_symbols),
+// dequantizes it, undoes the dct of `dct_method` over `shape` blocks and
+// hands every row of blocks of the dim1 x dim2 (padded) channels to
+// `writer`. Zero blocks and blocks without coefficients skip the IDCT.
+template <class BlockReader>
+static void inverse_transform(BlockReader read_block,
+                              const std::pair<uint64_t, uint64_t> channels,
+                              const uint64_t dim1, const uint64_t dim2,
+                              const float scale, const int16_t zero,
+                              const int32_t dct_method,
+                              const BlockShape &shape, SampleWriter &writer,
+                              Workspace &workspace) {
+  float steps[MAX_BLOCK_LENGTH];
+  quantization_steps(scale, dct_method, true, shape, steps);
+
+  if (dct_method == FLOAT_DCT) {
+    float_inverse_transform(read_block, channels, dim1, dim2, shape, steps,
+                            zero, writer, workspace);
+    return;
+  }
 
-  // read quality from header
-  int32_t quality;
-  {
-    uint8_t *quality_bytes = reinterpret_cast<uint8_t *>(&quality);
+  assert(shape.width == BLOCK_WIDTH);
 
-    const size_t quality_offset = input_size - 1 * sizeof(int32_t);
+  const codec::FastIDCT &idct =
+      dct_method == IFAST_DCT ? workspace.ifast_idct : workspace.islow_idct;
+  int32_t elements[MAX_BLOCK_LENGTH];
 
-    for (size_t i = 0; i < sizeof(int32_t); i++) {
-      quality_bytes[i] = input[i + quality_offset];
+  workspace.band.resize(BLOCK_WIDTH * dim2);
+  nn::Tensor<uint8_t, 3> band(workspace.band.data(), 1, BLOCK_WIDTH, dim2);
+
+  // the coefficients of a run of adjacent blocks that need the IDCT, so
+  // the wider kernels can batch them
+  std::vector<int16_t> &run_coefficients = workspace.coefficients;
+  run_coefficients.resize(dim2 / BLOCK_WIDTH * ZIGZAG_LENGTH);
+  size_t run_offset = 0;
+  int run_length = 0;
+
+  for (size_t channel = channels.first; channel < channels.second; channel++) {
+    for (size_t row_offset = 0; row_offset < dim1; row_offset += BLOCK_WIDTH) {
+      for (size_t col_offset = 0; col_offset < dim2;
+           col_offset += BLOCK_WIDTH) {
+        const int length = read_block(elements);
+
+        const int level = flat_level(length, zero);
+        if (level >= 0) {
+          fill_block(band, 0, 0, col_offset, BLOCK_WIDTH, level);
+
+          if (run_length > 0) {
+            idct.idct_blocks(run_coefficients.data(), band, 0, 0, run_offset,
+                             run_length);
+          }
+          run_length = 0;
+          continue;
+        }
+
+        if (run_length == 0) {
+          run_offset = col_offset;
+        }
+        dequantize_block(elements, length, shape, steps,
+                         &run_coefficients[run_length * ZIGZAG_LENGTH],
+                         BLOCK_WIDTH);
+        run_length++;
+      }
+
+      if (run_length > 0) {
+        idct.idct_blocks(run_coefficients.data(), band, 0, 0, run_offset,
+                         run_length);
+      }
+      run_length = 0;
+
+      writer.write_band(band, channel, row_offset);
     }
   }
+}
 
-  assert(dim1 % BLOCK_WIDTH == 0);
-  assert(dim2 % BLOCK_WIDTH == 0);
+static void check_dct_method(const int32_t dct_method) {
+  if (dct_method != ISLOW_DCT and dct_method != IFAST_DCT and
+      dct_method != FLOAT_DCT) {
+    throw std::runtime_error("unknown nnfc2 dct method: " +
+                             std::to_string(dct_method));
+  }
+}
+
+// 0 picks the block size per tensor (see adaptive_block_size); only the
+// float dct does block sizes other than 8
+static void check_block_size(const int32_t block_size,
+                             const int32_t dct_method) {
+  if (block_size != 0) {
+    block_shape(block_size);
+  }
+  if (block_size != 0 and block_size != BLOCK_WIDTH and
+      dct_method != FLOAT_DCT) {
+    throw std::runtime_error("nnfc2 block size " + std::to_string(block_size) +
+                             " needs the float dct");
+  }
+}
 
-  nn::Tensor<int16_t, 3> fp_output(dim0, dim1, dim2);
+// Small feature maps are better off with 4x4 blocks. 16x16 blocks are
+// never picked, since they would change the fidelity with the size of
+// the map (see quantization_steps). Falls back to the largest size that
+// divides both dimensions, which needs the least padding.
+static int adaptive_block_size(const int32_t dct_method, const uint64_t dim1,
+                               const uint64_t dim2) {
+  if (dct_method != FLOAT_DCT) {
+    return BLOCK_WIDTH;
+  }
 
-  assert(quality > 0);
-  assert(quality <= 100);
-  const float scale = quality < 50 ? 50.f / quality : (100.f - quality) / 50;
+  const uint64_t size = std::min(dim1, dim2);
+  int width = size < 16 ? 4 : BLOCK_WIDTH;
+  while (width > 4 and (dim1 % width or dim2 % width)) {
+    width /= 2;
+  }
+  return width;
+}
 
-  std::vector<char> encoding_(reinterpret_cast<const char *>(input.data()),
-                              reinterpret_cast<const char *>(input.data()) +
-                                  input_size - 3 * sizeof(uint64_t) -
-                                  2 * sizeof(float) - 1 * sizeof(int32_t));
+static void check_entropy_coder(const int32_t entropy_coder) {
+  if (entropy_coder != ARITHMETIC_ENTROPY_CODER and
+      entropy_coder != BINARY_ENTROPY_CODER and
+      entropy_coder != HUFFMAN_ENTROPY_CODER) {
+    throw std::runtime_error("unknown nnfc2 entropy coder: " +
+                             std::to_string(entropy_coder));
+  }
+}
 
-  codec::ArithmeticDecoder<codec::SimpleAdaptiveModel> decoder(encoding_, DCT_MAX - DCT_MIN + 1);
-  
-  /*  codec::ArithmeticDecoder<codec::SimpleAdaptiveModel> decoder( encoding_, \
-   "{\"denominator\":32899,\"num_symbols\":128,\"sym_0_lower\":0,\"sym_0_upper\":1,\"sym_100_lower\":32868,\"sym_100_upper\":32869,\"sym_101_lower\":32869,\"sym_101_upper\":32870,\"sym_102_lower\":32870,\"sym_102_upper\":32871,\"sym_103_lower\":32871,\"sym_103_upper\":32872,\"sym_104_lower\":32872,\"sym_104_upper\":32873,\"sym_105_lower\":32873,\"sym_105_upper\":32874,\"sym_106_lower\":32874,\"sym_106_upper\":32875,\"sym_107_lower\":32875,\"sym_107_upper\":32876,\"sym_108_lower\":32876,\"sym_108_upper\":32877,\"sym_109_lower\":32877,\"sym_109_upper\":32878,\"sym_10_lower\":10,\"sym_10_upper\":11,\"sym_110_lower\":32878,\"sym_110_upper\":32879,\"sym_111_lower\":32879,\"sym_111_upper\":32880,\"sym_112_lower\":32880,\"sym_112_upper\":32881,\"sym_113_lower\":32881,\"sym_113_upper\":32882,\"sym_114_lower\":32882,\"sym_114_upper\":32883,\"sym_115_lower\":32883,\"sym_115_upper\":32884,\"sym_116_lower\":32884,\"sym_116_upper\":32885,\"sym_117_lower\":32885,\"sym_117_upper\":32886,\"sym_118_lower\":32886,\"sym_118_upper\":32887,\"sym_119_lower\":32887,\"sym_119_upper\":32888,\"sym_11_lower\":11,\"sym_11_upper\":12,\"sym_120_lower\":32888,\"sym_120_upper\":32889,\"sym_121_lower\":32889,\"sym_121_upper\":32890,\"sym_122_lower\":32890,\"sym_122_upper\":32891,\"sym_123_lower\":32891,\"sym_123_upper\":32892,\"sym_124_lower\":32892,\"sym_124_upper\":32893,\"sym_125_lower\":32893,\"sym_125_upper\":32894,\"sym_126_lower\":32894,\"sym_126_upper\":32895,\"sym_127_lower\":32895,\"sym_127_upper\":32896,\"sym_12_lower\":12,\"sym_12_upper\":13,\"sym_13_lower\":13,\"sym_13_upper\":14,\"sym_14_lower\":14,\"sym_14_upper\":15,\"sym_15_lower\":15,\"sym_15_upper\":16,\"sym_16_lower\":16,\"sym_16_upper\":17,\"sym_17_lower\":17,\"sym_17_upper\":18,\"sym_18_lower\":18,\"sym_18_upper\":19,\"sym_19_lower\":19,\"sym_19_upper\":20,\"sym_1_lower\":1,\"sym_1_upper\":2,\"sym_20_lower\":20,\"sym_20_upper\":21,\"sym_21_lower\":21,\"sym_21_upper\":22,\"sym_22_lower\":22,\"sym_22_upper\":23,\"sym_23_lower\":23,\"sym_23_upper\":24,\"sym_24_lower\":24,\"sym_24_upper\":25,\"sym_25_lower\":25,\"sym_25_upper\":26,\"sym_26_lower\":26,\"sym_26_upper\":27,\"sym_27_lower\":27,\"sym_27_upper\":28,\"sym_28_lower\":28,\"sym_28_upper\":29,\"sym_29_lower\":29,\"sym_29_upper\":30,\"sym_2_lower\":2,\"sym_2_upper\":3,\"sym_30_lower\":30,\"sym_30_upper\":31,\"sym_31_lower\":31,\"sym_31_upper\":32,\"sym_32_lower\":32,\"sym_32_upper\":33,\"sym_33_lower\":33,\"sym_33_upper\":34,\"sym_34_lower\":34,\"sym_34_upper\":35,\"sym_35_lower\":35,\"sym_35_upper\":36,\"sym_36_lower\":36,\"sym_36_upper\":37,\"sym_37_lower\":37,\"sym_37_upper\":38,\"sym_38_lower\":38,\"sym_38_upper\":39,\"sym_39_lower\":39,\"sym_39_upper\":40,\"sym_3_lower\":3,\"sym_3_upper\":4,\"sym_40_lower\":40,\"sym_40_upper\":41,\"sym_41_lower\":41,\"sym_41_upper\":43,\"sym_42_lower\":43,\"sym_42_upper\":44,\"sym_43_lower\":44,\"sym_43_upper\":47,\"sym_44_lower\":47,\"sym_44_upper\":50,\"sym_45_lower\":50,\"sym_45_upper\":52,\"sym_46_lower\":52,\"sym_46_upper\":54,\"sym_47_lower\":54,\"sym_47_upper\":61,\"sym_48_lower\":61,\"sym_48_upper\":70,\"sym_49_lower\":70,\"sym_49_upper\":77,\"sym_4_lower\":4,\"sym_4_upper\":5,\"sym_50_lower\":77,\"sym_50_upper\":90,\"sym_51_lower\":90,\"sym_51_upper\":104,\"sym_52_lower\":104,\"sym_52_upper\":125,\"sym_53_lower\":125,\"sym_53_upper\":142,\"sym_54_lower\":142,\"sym_54_upper\":171,\"sym_55_lower\":171,\"sym_55_upper\":216,\"sym_56_lower\":216,\"sym_56_upper\":266,\"sym_57_lower\":266,\"sym_57_upper\":335,\"sym_58_lower\":335,\"sym_58_upper\":416,\"sym_59_lower\":416,\"sym_59_upper\":572,\"sym_5_lower\":5,\"sym_5_upper\":6,\"sym_60_lower\":572,\"sym_60_upper\":792,\"sym_61_lower\":792,\"sym_61_upper\":1167,\"sym_62_lower\":1167,\"sym_62_upper\":1950,\"sym_63_lower\":1950,\"sym_63_upper\":4265,\"sym_64_lower\":4265,\"sym_64_upper\":28851,\"sym_65_lower\":28851,\"sym_65_upper\":31167,\"sym_66_lower\":31167,\"sym_66_upper\":31950,\"sym_67_lower\":31950,\"sym_67_upper\":32294,\"sym_68_lower\":32294,\"sym_68_upper\":32483,\"sym_69_lower\":32483,\"sym_69_upper\":32609,\"sym_6_lower\":6,\"sym_6_upper\":7,\"sym_70_lower\":32609,\"sym_70_upper\":32670,\"sym_71_lower\":32670,\"sym_71_upper\":32720,\"sym_72_lower\":32720,\"sym_72_upper\":32761,\"sym_73_lower\":32761,\"sym_73_upper\":32782,\"sym_74_lower\":32782,\"sym_74_upper\":32804,\"sym_75_lower\":32804,\"sym_75_upper\":32810,\"sym_76_lower\":32810,\"sym_76_upper\":32815,\"sym_77_lower\":32815,\"sym_77_upper\":32825,\"sym_78_lower\":32825,\"sym_78_upper\":32832,\"sym_79_lower\":32832,\"sym_79_upper\":32837,\"sym_7_lower\":7,\"sym_7_upper\":8,\"sym_80_lower\":32837,\"sym_80_upper\":32840,\"sym_81_lower\":32840,\"sym_81_upper\":32844,\"sym_82_lower\":32844,\"sym_82_upper\":32847,\"sym_83_lower\":32847,\"sym_83_upper\":32849,\"sym_84_lower\":32849,\"sym_84_upper\":32850,\"sym_85_lower\":32850,\"sym_85_upper\":32852,\"sym_86_lower\":32852,\"sym_86_upper\":32854,\"sym_87_lower\":32854,\"sym_87_upper\":32856,\"sym_88_lower\":32856,\"sym_88_upper\":32857,\"sym_89_lower\":32857,\"sym_89_upper\":32858,\"sym_8_lower\":8,\"sym_8_upper\":9,\"sym_90_lower\":32858,\"sym_90_upper\":32859,\"sym_91_lower\":32859,\"sym_91_upper\":32860,\"sym_92_lower\":32860,\"sym_92_upper\":32861,\"sym_93_lower\":32861,\"sym_93_upper\":32862,\"sym_94_lower\":32862,\"sym_94_upper\":32863,\"sym_95_lower\":32863,\"sym_95_upper\":32864,\"sym_96_lower\":32864,\"sym_96_upper\":32865,\"sym_97_lower\":32865,\"sym_97_upper\":32866,\"sym_98_lower\":32866,\"sym_98_upper\":32867,\"sym_99_lower\":32867,\"sym_99_upper\":32868,\"sym_9_lower\":9,\"sym_9_upper\":10,\"sym_end_lower\":32896,\"sym_end_upper\":32898}" \
-   ); */
-  // codec::DummyArithmeticDecoder decoder(encoding_);
+nnfc::NNFC2Encoder::NNFC2Encoder(int probability_model, int slices,
+                                 int entropy_coder, int dct_method,
+                                 int block_size)
+    : quality_(48),
+      probability_model_(probability_model),
+      slices_(slices),
+      entropy_coder_(entropy_coder),
+      dct_method_(dct_method),
+      block_size_(block_size) {
+  // fail early on an unknown or mismatched table
+  probability_table(probability_model_);
+  check_entropy_coder(entropy_coder_);
+  check_dct_method(dct_method_);
+  check_block_size(block_size_, dct_method_);
+
+  if (slices_ < 1) {
+    throw std::runtime_error("nnfc2 needs at least one slice");
+  }
+}
 
-  // double time = 0;
-  // size_t count = 0;
+nnfc::NNFC2Encoder::~NNFC2Encoder() {}
 
-  // undo arithmetic encoding and deserialize
-  for (size_t channel = 0; channel < dim0; channel++) {
-    for (size_t block_row = 0; block_row < dim1 / BLOCK_WIDTH; block_row++) {
-      for (size_t block_col = 0; block_col < dim2 / BLOCK_WIDTH; block_col++) {
-        for (size_t i = 0; i < ZIGZAG_LENGTH; i++) {
-          const size_t row_offset =
-              BLOCK_WIDTH * block_row + ZIGZAG_ORDER[i][0];
-          const size_t col_offset =
-              BLOCK_WIDTH * block_col + ZIGZAG_ORDER[i][1];
-
-          // auto t1 = std::chrono::high_resolution_clock::now();
-          uint32_t symbol = decoder.decode_symbol();
-          // auto t2 = std::chrono::high_resolution_clock::now();
-          // count += 1;
-          // time +=
-          //     std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1)
-          //         .count();
+std::vector<uint8_t> nnfc::NNFC2Encoder::forward(
+    const nn::Tensor<float, 3> t_input) const {
+  const uint64_t dim0 = t_input.dimension(0);
+  const uint64_t dim1 = t_input.dimension(1);
+  const uint64_t dim2 = t_input.dimension(2);
 
-          assert(symbol < (DCT_MAX - DCT_MIN + 1));
-          int32_t element = symbol + DCT_MIN;
+  const std::pair<float, float> value_bounds = value_range(t_input);
+  const float min = value_bounds.first;
+  const float max = value_bounds.second;
+
+  const float scale = quality_scale(quality_);
+  const codec::ProbabilityTable table = probability_table(probability_model_);
+  const int32_t block_size = block_size_ != 0
+                                 ? block_size_
+                                 : adaptive_block_size(dct_method_, dim1, dim2);
+  const BlockShape &shape = block_shape(block_size);
+
+  // every slice is a group of channels with its own arithmetic coder, so
+  // the slices can be transformed and coded in parallel
+  const uint32_t num_slices =
+      std::min<uint64_t>(slices_, std::max<uint64_t>(dim0, 1));
+  std::vector<std::vector<char>> slice_encodings(num_slices);
+
+  nn::Tensor<float, 3> input(t_input);
+
+  // rethrow the first failure once all of the slices are done, as the
+  // decoder does
+  std::vector<std::exception_ptr> slice_errors(num_slices);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (uint32_t slice = 0; slice < num_slices; slice++) {
+    try {
+      const auto channels = slice_channels(dim0, num_slices, slice);
+      if (channels.first == channels.second) {
+        continue;
+      }
 
-          float scalef = scale * JPEG_QUANTIZATION[i];
-          if (scalef < 1) {
-            scalef = 1;
+      const nn::Tensor<float, 3> slice_input(&input(channels.first, 0, 0),
+                                             channels.second - channels.first,
+                                             dim1, dim2);
+      Workspace &workspace = codec::thread_workspace<Workspace>();
+      const nn::Tensor<int16_t, 3> samples =
+          forward_transform(slice_input, min, max, block_size, workspace);
+
+      if (entropy_coder_ == BINARY_ENTROPY_CODER) {
+        codec::BinaryArithmeticEncoder encoder;
+        CoefficientContexts contexts(shape.length);
+
+        for_each_block(samples, workspace, scale, dct_method_, shape,
+                       [&encoder, &contexts](const int32_t *elements,
+                                             const int length) {
+                         encode_bins(encoder, contexts, elements, length);
+                       });
+
+        slice_encodings[slice] = encoder.finish();
+      } else if (entropy_coder_ == HUFFMAN_ENTROPY_CODER) {
+        std::vector<uint32_t> &symbols = workspace.symbols;
+        symbols.clear();
+        emit_symbols(samples, workspace, scale, dct_method_, shape,
+                     [&symbols](const uint32_t symbol) {
+                       symbols.push_back(symbol);
+                     });
+
+        std::vector<char> &encoding = slice_encodings[slice];
+        std::unique_ptr<codec::HuffmanTable> slice_table;
+        if (probability_model_ == 0) {
+          std::vector<uint64_t> counts(NUM_SYMBOLS, 0);
+          for (const uint32_t symbol : symbols) {
+            counts[symbol]++;
           }
+          const std::vector<uint8_t> lengths =
+              codec::huffman_code_lengths(counts);
+          codec::write_huffman_code_lengths(encoding, lengths);
+          slice_table = std::make_unique<codec::HuffmanTable>(lengths);
+        }
+
+        const codec::HuffmanTable &huffman_table =
+            slice_table ? *slice_table
+                        : trained_huffman_table(workspace, probability_model_,
+                                                table);
+        codec::HuffmanEncoder encoder(huffman_table);
+        for (const uint32_t symbol : symbols) {
+          encoder.encode_symbol(symbol);
+        }
+
+        const std::vector<char> codes = encoder.finish();
+        encoding.insert(encoding.end(), codes.begin(), codes.end());
+      } else {
+        // codec::DummyArithmeticEncoder encoder;
+        codec::ArithmeticEncoder<codec::PowerOfTwoAdaptiveModel> encoder(table);
+
+        // arithmetic encode and serialize data
+        emit_symbols(samples, workspace, scale, dct_method_, shape,
+                     [&encoder](const uint32_t symbol) {
+                       encoder.encode_symbol(symbol);
+                     });
+
+        slice_encodings[slice] = encoder.finish();
+      }
+    } catch (...) {
+      slice_errors[slice] = std::current_exception();
+    }
+  }
 
-          const float value = scalef * element;
+  for (const std::exception_ptr &error : slice_errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
 
-          // clip if necessary
-          // if (value < DCT_MIN) {
-          //     value = DCT_MIN;
-          // }
-          // if (value >= DCT_MAX) {
-          //     value = DCT_MAX;
-          // }
-          // assert(value >= DCT_MIN);
-          // assert(value <= DCT_MAX);
+  // concatenate the slices and remember where each of them ends
+  std::vector<char> encoding;
+  std::vector<uint64_t> slice_ends;
+  for (uint32_t slice = 0; slice < num_slices; slice++) {
+    encoding.insert(encoding.end(), slice_encodings[slice].begin(),
+                    slice_encodings[slice].end());
+    slice_ends.push_back(encoding.size());
+  }
+
+  // add slice offset table
+  for (const uint64_t slice_end : slice_ends) {
+    write_footer_field<uint64_t>(encoding, slice_end);
+  }
 
-          fp_output(channel, row_offset, col_offset) = std::round(value);
+  // add footer
+  write_footer_field<uint64_t>(encoding, dim0);
+  write_footer_field<uint64_t>(encoding, dim1);
+  write_footer_field<uint64_t>(encoding, dim2);
+  write_footer_field<float>(encoding, min);
+  write_footer_field<float>(encoding, max);
+  write_footer_field<int32_t>(encoding, quality_);
+  write_footer_field<int32_t>(encoding, probability_model_);
+  write_footer_field<int32_t>(encoding, entropy_coder_);
+  write_footer_field<int32_t>(encoding, dct_method_);
+  write_footer_field<int32_t>(encoding, block_size);
+  write_footer_field<uint32_t>(encoding, num_slices);
+
+  std::vector<uint8_t> encoding_(
+      reinterpret_cast<uint8_t *>(encoding.data()),
+      reinterpret_cast<uint8_t *>(encoding.data()) + encoding.size());
+
+  return encoding_;
+}
+
+std::vector<uint32_t> nnfc::NNFC2Encoder::coefficient_symbols(
+    const nn::Tensor<float, 3> t_input) const {
+  const std::pair<float, float> value_bounds = value_range(t_input);
+  const float min = value_bounds.first;
+  const float max = value_bounds.second;
+  const int32_t block_size =
+      block_size_ != 0 ? block_size_
+                       : adaptive_block_size(dct_method_, t_input.dimension(1),
+                                             t_input.dimension(2));
+
+  Workspace &workspace = codec::thread_workspace<Workspace>();
+  const nn::Tensor<int16_t, 3> samples =
+      forward_transform(t_input, min, max, block_size, workspace);
+
+  std::vector<uint32_t> symbols;
+  emit_symbols(samples, workspace, quality_scale(quality_), dct_method_,
+               block_shape(block_size),
+               [&symbols](const uint32_t symbol) { symbols.push_back(symbol); });
+
+  return symbols;
+}
+
+uint32_t nnfc::NNFC2Encoder::num_symbols() { return NUM_SYMBOLS; }
+
+nn::Tensor<float, 3> nnfc::NNFC2Encoder::backward(
+    const nn::Tensor<float, 3> input) const {
+  return input;
+}
+
+nnfc::NNFC2Decoder::NNFC2Decoder() {}
+
+nnfc::NNFC2Decoder::~NNFC2Decoder() {}
+
+nn::Tensor<float, 3> nnfc::NNFC2Decoder::forward(
+    const std::vector<uint8_t> input) const {
+  const size_t input_size = input.size();
+
+  if (input_size < FOOTER_SIZE) {
+    throw std::runtime_error("nnfc2 input is too short");
+  }
+
+  // read the footer
+  size_t footer_offset = input_size - FOOTER_SIZE;
+  const uint64_t dim0 = read_footer_field<uint64_t>(input, footer_offset);
+  const uint64_t dim1 = read_footer_field<uint64_t>(input, footer_offset);
+  const uint64_t dim2 = read_footer_field<uint64_t>(input, footer_offset);
+  const float min = read_footer_field<float>(input, footer_offset);
+  const float max = read_footer_field<float>(input, footer_offset);
+  const int32_t quality = read_footer_field<int32_t>(input, footer_offset);
+  const int32_t probability_model =
+      read_footer_field<int32_t>(input, footer_offset);
+  const int32_t entropy_coder =
+      read_footer_field<int32_t>(input, footer_offset);
+  const int32_t dct_method = read_footer_field<int32_t>(input, footer_offset);
+  const int32_t block_size = read_footer_field<int32_t>(input, footer_offset);
+  const uint32_t num_slices = read_footer_field<uint32_t>(input, footer_offset);
+  assert(footer_offset == input_size);
+
+  // read the slice offset table
+  if (num_slices == 0 ||
+      num_slices > (input_size - FOOTER_SIZE) / sizeof(uint64_t)) {
+    throw std::runtime_error("nnfc2 input has a bad slice count");
+  }
+  const size_t data_size =
+      input_size - FOOTER_SIZE - num_slices * sizeof(uint64_t);
+
+  size_t table_offset = data_size;
+  std::vector<uint64_t> slice_ends;
+  for (uint32_t slice = 0; slice < num_slices; slice++) {
+    slice_ends.push_back(read_footer_field<uint64_t>(input, table_offset));
+    const uint64_t slice_begin = slice == 0 ? 0 : slice_ends[slice - 1];
+    if (slice_ends[slice] < slice_begin || slice_ends[slice] > data_size) {
+      throw std::runtime_error("nnfc2 input has a bad slice offset");
+    }
+  }
+
+  const float range = max - min;
+
+  const float scale = quality_scale(quality);
+  const codec::ProbabilityTable table = probability_table(probability_model);
+  check_entropy_coder(entropy_coder);
+  check_dct_method(dct_method);
+  if (block_size == 0) {
+    throw std::runtime_error("nnfc2 input has no block size");
+  }
+  check_block_size(block_size, dct_method);
+  const BlockShape &shape = block_shape(block_size);
+
+  // the blocks cover the dimensions padded to whole blocks
+  const uint64_t padded_rows = padded_size(dim1, block_size);
+  const uint64_t padded_cols = padded_size(dim2, block_size);
+  const int16_t zero = zero_level(min, max);
+
+  nn::Tensor<float, 3> output(dim0, dim1, dim2);
+  SampleWriter writer{output, min, range};
+
+  // slices are independent, so decode them in parallel and rethrow the
+  // first failure once all of them are done
+  std::vector<std::exception_ptr> slice_errors(num_slices);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (uint32_t slice = 0; slice < num_slices; slice++) {
+    try {
+      const auto channels = slice_channels(dim0, num_slices, slice);
+      if (channels.first == channels.second) {
+        continue;
+      }
+
+      Workspace &workspace = codec::thread_workspace<Workspace>();
+      const char *slice_data = reinterpret_cast<const char *>(input.data());
+      std::vector<char> encoding_(
+          slice_data + (slice == 0 ? 0 : slice_ends[slice - 1]),
+          slice_data + slice_ends[slice]);
+
+      if (entropy_coder == BINARY_ENTROPY_CODER) {
+        codec::BinaryArithmeticDecoder decoder(encoding_);
+        CoefficientContexts contexts(shape.length);
+
+        inverse_transform(
+            [&decoder, &contexts](int32_t *elements) {
+              return decode_bins(decoder, contexts, elements);
+            },
+            channels, padded_rows, padded_cols, scale, zero, dct_method,
+            shape, writer, workspace);
+      } else if (entropy_coder == HUFFMAN_ENTROPY_CODER) {
+        size_t offset = 0;
+        std::unique_ptr<codec::HuffmanTable> slice_table;
+        if (probability_model == 0) {
+          slice_table = std::make_unique<codec::HuffmanTable>(
+              codec::read_huffman_code_lengths(encoding_, offset,
+                                               NUM_SYMBOLS));
         }
+
+        const codec::HuffmanTable &huffman_table =
+            slice_table ? *slice_table
+                        : trained_huffman_table(workspace, probability_model,
+                                                table);
+        codec::HuffmanDecoder decoder(
+            std::vector<char>(encoding_.begin() + offset, encoding_.end()),
+            huffman_table);
+
+        inverse_transform(
+            [&decoder, &shape](int32_t *elements) {
+              return read_symbols(decoder, shape.length, elements);
+            },
+            channels, padded_rows, padded_cols, scale, zero, dct_method,
+            shape, writer, workspace);
+      } else {
+        codec::FastArithmeticDecoder<codec::PowerOfTwoAdaptiveModel> decoder(
+            encoding_, table);
+        // codec::DummyArithmeticDecoder decoder(encoding_);
+
+        inverse_transform(
+            [&decoder, &shape](int32_t *elements) {
+              return read_symbols(decoder, shape.length, elements);
+            },
+            channels, padded_rows, padded_cols, scale, zero, dct_method,
+            shape, writer, workspace);
       }
+    } catch (...) {
+      slice_errors[slice] = std::current_exception();
     }
   }
 
-  // std::cout << "total time [decode] (count=" << time  << "): " << time <<
-  // std::endl; std::cout << "avg time [decode]: " << time / count << std::endl;
-
-  // undo the dct
-  // nn::Tensor<int16_t, 3> idct_output(fp_output);
-  codec::FastIDCT idct;
-  nn::Tensor<uint8_t, 3> idct_output = idct(fp_output);
-  // std::cout << (int)idct_output.minimum() << std::endl;
-  // std::cout << (int)idct_output.maximum() << std::endl;
-  // nn::Tensor<float, 3> idct_output(
-  //     std::move(codec::utils::idct(fp_output, BLOCK_WIDTH)));
-
-  // dequantize from 8-bits
-  Eigen::Tensor<float, 3, Eigen::RowMajor> dq1_output =
-      range * idct_output.tensor().cast<float>();
-  Eigen::Tensor<float, 3, Eigen::RowMajor> dq2_output =
-      ((1 / 255.f) * dq1_output) + min;
-
-  // Eigen::Tensor<float, 3, Eigen::RowMajor> dq1_output =
-  //     range * (idct_output.tensor().cast<float>());
-  // Eigen::Tensor<float, 3, Eigen::RowMajor> dq2_output =
-  //     ((1 / 127.f) * dq1_output) + min;
-
-  // Eigen::Tensor<float, 3, Eigen::RowMajor> dq1_output =
-  //     range * (idct_output.tensor() + 32.f);
-  // Eigen::Tensor<float, 3, Eigen::RowMajor> dq2_output =
-  //     ((1 / 63.f) * dq1_output) + min;
-
-  // convert into nn::Tensor
-  nn::Tensor<float, 3> output(dq2_output);
+  for (const std::exception_ptr &error : slice_errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
 
   return output;
 }
@@ -12,16 +12,47 @@ namespace nnfc {
 class NNFC2Encoder {
  private:
   const int32_t quality_;
+  const int32_t probability_model_;
+  const int32_t slices_;
+  const int32_t entropy_coder_;
+  const int32_t dct_method_;
+  const int32_t block_size_;
 
  public:
-  NNFC2Encoder();
+  // `probability_model` selects the initial state of the entropy
+  // coder: 0 is a uniform adaptive model, k > 0 is the k-th table in
+  // nnfc2_probability_tables.hh. `slices` splits the channels into
+  // that many independently coded (and decodable) groups.
+  // `entropy_coder` 0 is the multi-symbol arithmetic coder, 1 the
+  // context adaptive binary arithmetic coder and 2 a canonical Huffman
+  // coder. The probability model seeds the arithmetic coder; for the
+  // Huffman coder a trained table gives fixed codes and model 0 builds
+  // codes from every slice's own histogram. `dct_method` 0 is libjpeg's
+  // accurate integer DCT, 1 its fast (less accurate) integer DCT and 2 a
+  // floating point DCT. `block_size` is the width of the DCT blocks: 4, 8
+  // or 16 (the integer DCTs only do 8), or 0 to pick 4 or 8 from the size
+  // of every tensor. 4x4 and 8x8 blocks quantize with the same error;
+  // 16x16 blocks need coarser steps and give about twice the error. The
+  // choices are recorded in the bitstream, so the decoder follows them.
+  NNFC2Encoder(int probability_model, int slices, int entropy_coder,
+               int dct_method, int block_size);
   ~NNFC2Encoder();
 
   std::vector<uint8_t> forward(const nn::Tensor<float, 3> input) const;
   nn::Tensor<float, 3> backward(const nn::Tensor<float, 3> input) const;
 
+  // The symbols the entropy coder sees for `input`, in coding order.
+  // Used to train probability tables offline.
+  std::vector<uint32_t> coefficient_symbols(
+      const nn::Tensor<float, 3> input) const;
+  static uint32_t num_symbols();
+
   static nnfc::cxxapi::constructor_type_list initialization_params() {
-    return {};
+    return {{"probability_model", typeid(int)},
+            {"slices", typeid(int)},
+            {"entropy_coder", typeid(int)},
+            {"dct_method", typeid(int)},
+            {"block_size", typeid(int)}};
   }
 };
 
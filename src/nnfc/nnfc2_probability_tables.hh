@@ -0,0 +1,51 @@
+#ifndef _NNFC_NNFC2_PROBABILITY_TABLES_HH
+#define _NNFC_NNFC2_PROBABILITY_TABLES_HH
+
+#include <cstdint>
+
+#include "codec/arithmetic_probability_models.hh"
+
+// Pre-trained symbol frequencies for the NNFC2 entropy coder. Tables are
+// selected with the `probability_model` constructor parameter of
+// `nnfc::NNFC2Encoder`; id 0 is the uniform adaptive model and id `k`
+// is entry `k - 1` of `NNFC2_PROBABILITY_TABLES`. The id is written into
+// the bitstream so the decoder picks the same table.
+//
+// New tables are generated with src/frontend/train_probability_model
+// and pasted below. Never reorder or remove entries; that would change
+// the meaning of existing bitstreams.
+
+namespace nnfc {
+
+// Final state of an adaptive model dumped after coding a run of
+// activations (formerly kept as a JSON literal inside nnfc2_codec.cc).
+// The +64 coefficient was never observed and gets the minimum count.
+// The dump predates the EOB and ZERO_BLOCK symbols (the two entries
+// before end-of-message), so they start at the minimum count as well;
+// retrain to get a prior for them.
+static constexpr uint32_t NNFC2_TABLE_1_FREQUENCIES[] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 2, 1, 3, 3, 2, 2, 7, 9, 7,
+    13, 14, 21, 17, 29, 45, 50, 69, 81, 156,
+    220, 375, 783, 2315, 24586, 2316, 783, 344, 189, 126,
+    61, 50, 41, 21, 22, 6, 5, 10, 7, 5,
+    3, 4, 3, 2, 1, 2, 2, 2, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 2,
+};
+
+static constexpr codec::ProbabilityTable NNFC2_PROBABILITY_TABLES[] = {
+    {131, NNFC2_TABLE_1_FREQUENCIES},
+};
+
+static constexpr size_t NNFC2_NUM_PROBABILITY_TABLES =
+    sizeof(NNFC2_PROBABILITY_TABLES) / sizeof(NNFC2_PROBABILITY_TABLES[0]);
+}  // namespace nnfc
+
+#endif  // _NNFC_NNFC2_PROBABILITY_TABLES_HH
@@ -1,10 +1,12 @@
 #include <any>
 #include <array>
 #include <cstdint>
+#include <exception>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <typeinfo>
 #include <vector>
 
@@ -27,6 +29,29 @@
 // helper classes
 //
 //////////////////////////////////////////////////////////////////////
+
+// Contexts that share state across the items of a batch (see
+// NNFC1Encoder) code whole batches with their own `forward_batch`.
+template <class ContextType, class input_T, class = void>
+struct has_forward_batch : std::false_type {};
+
+template <class ContextType, class input_T>
+struct has_forward_batch<
+    ContextType, input_T,
+    std::void_t<decltype(std::declval<ContextType &>().forward_batch(
+        std::declval<const std::vector<input_T> &>()))>> : std::true_type {};
+
+// Encoders that code a stream (see MPEGStreamEncoder) can be asked for a
+// keyframe.
+template <class ContextType, class = void>
+struct has_request_keyframe : std::false_type {};
+
+template <class ContextType>
+struct has_request_keyframe<
+    ContextType,
+    std::void_t<decltype(std::declval<ContextType &>().request_keyframe())>>
+    : std::true_type {};
+
 template <class ContextInterface, class ContextType, class input_T,
           class output_T, typename... constructor_args_types>
 class ContextContainer : public ContextInterface {
@@ -40,6 +65,7 @@ class ContextContainer : public ContextInterface {
   static constexpr size_t num_constructor_args =
       std::tuple_size<std::tuple<constructor_args_types...>>{};
 
+ protected:
   std::unique_ptr<ContextType> context_;
 
  public:
@@ -79,6 +105,35 @@ class ContextContainer : public ContextInterface {
 
   output_T forward(input_T input) override { return context_->forward(input); }
 
+  std::vector<output_T> forward_batch(
+      const std::vector<input_T> &inputs) override {
+    if constexpr (has_forward_batch<ContextType, input_T>::value) {
+      return context_->forward_batch(inputs);
+    } else {
+      // the items are independent, so code them in parallel and rethrow
+      // the first failure once all of them are done
+      const size_t batch_size = inputs.size();
+      std::vector<output_T> outputs(batch_size);
+      std::vector<std::exception_ptr> errors(batch_size);
+
+#pragma omp parallel for if (batch_size > 1)
+      for (size_t i = 0; i < batch_size; i++) {
+        try {
+          outputs[i] = context_->forward(inputs[i]);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      }
+
+      for (const std::exception_ptr &error : errors) {
+        if (error) {
+          std::rethrow_exception(error);
+        }
+      }
+      return outputs;
+    }
+  }
+
   nn::Tensor<float, 3> backward(
       nn::Tensor<float, 3> gradient_of_output) override {
     return context_->backward(gradient_of_output);
@@ -96,6 +151,12 @@ class EncoderContextContainer
                          EncoderContextType, nn::Tensor<float, 3>,
                          std::vector<uint8_t>, constructor_args_types...>(
             initialization_params) {}
+
+  void request_keyframe() override {
+    if constexpr (has_request_keyframe<EncoderContextType>::value) {
+      this->context_->request_keyframe();
+    }
+  }
 };
 
 template <class DecoderContextType, typename... constructor_args_types>
@@ -167,10 +228,10 @@ static std::vector<EncoderContextFactory> nnfc_available_encoders = {
      .new_context_func = new_encoder<nnfc::RGBSwizzlerEncoder>,
      .constructor_types_func = constructor_types<nnfc::RGBSwizzlerEncoder>},
     {.exported_name = "jpeg_encoder",
-     .new_context_func = new_encoder<nnfc::JPEGEncoder, int>,
+     .new_context_func = new_encoder<nnfc::JPEGEncoder, int, int, int>,
      .constructor_types_func = constructor_types<nnfc::JPEGEncoder>},
     {.exported_name = "jpeg_image_encoder",
-     .new_context_func = new_encoder<nnfc::JPEGImageEncoder, int>,
+     .new_context_func = new_encoder<nnfc::JPEGImageEncoder, int, int>,
      .constructor_types_func = constructor_types<nnfc::JPEGImageEncoder>},
     {.exported_name = "h264_image_encoder",
      .new_context_func = new_encoder<nnfc::H264ImageEncoder, int>,
@@ -179,16 +240,23 @@ static std::vector<EncoderContextFactory> nnfc_available_encoders = {
      .new_context_func = new_encoder<nnfc::H265ImageEncoder, int>,
      .constructor_types_func = constructor_types<nnfc::H265ImageEncoder>},
     {.exported_name = "avc_encoder",
-     .new_context_func = new_encoder<nnfc::AVCEncoder, int>,
+     .new_context_func = new_encoder<nnfc::AVCEncoder, int, int>,
      .constructor_types_func = constructor_types<nnfc::AVCEncoder>},
     {.exported_name = "heif_encoder",
-     .new_context_func = new_encoder<nnfc::HEIFEncoder, int>,
+     .new_context_func = new_encoder<nnfc::HEIFEncoder, int, int>,
      .constructor_types_func = constructor_types<nnfc::HEIFEncoder>},
+    {.exported_name = "avc_stream_encoder",
+     .new_context_func = new_encoder<nnfc::AVCStreamEncoder, int, int, int>,
+     .constructor_types_func = constructor_types<nnfc::AVCStreamEncoder>},
+    {.exported_name = "heif_stream_encoder",
+     .new_context_func = new_encoder<nnfc::HEIFStreamEncoder, int, int, int>,
+     .constructor_types_func = constructor_types<nnfc::HEIFStreamEncoder>},
     {.exported_name = "nnfc1_encoder",
-     .new_context_func = new_encoder<nnfc::NNFC1Encoder>,
+     .new_context_func = new_encoder<nnfc::NNFC1Encoder, int, int>,
      .constructor_types_func = constructor_types<nnfc::NNFC1Encoder>},
     {.exported_name = "nnfc2_encoder",
-     .new_context_func = new_encoder<nnfc::NNFC2Encoder>,
+     .new_context_func =
+         new_encoder<nnfc::NNFC2Encoder, int, int, int, int, int>,
      .constructor_types_func = constructor_types<nnfc::NNFC2Encoder>}};
 
 static std::vector<DecoderContextFactory> nnfc_available_decoders = {
@@ -216,6 +284,12 @@ static std::vector<DecoderContextFactory> nnfc_available_decoders = {
     {.exported_name = "heif_decoder",
      .new_context_func = new_decoder<nnfc::HEIFDecoder>,
      .constructor_types_func = constructor_types<nnfc::HEIFDecoder>},
+    {.exported_name = "avc_stream_decoder",
+     .new_context_func = new_decoder<nnfc::AVCStreamDecoder>,
+     .constructor_types_func = constructor_types<nnfc::AVCStreamDecoder>},
+    {.exported_name = "heif_stream_decoder",
+     .new_context_func = new_decoder<nnfc::HEIFStreamDecoder>,
+     .constructor_types_func = constructor_types<nnfc::HEIFStreamDecoder>},
     {.exported_name = "nnfc1_decoder",
      .new_context_func = new_decoder<nnfc::NNFC1Decoder>,
      .constructor_types_func = constructor_types<nnfc::NNFC1Decoder>},
@@ -14,19 +14,30 @@ typedef std::vector<std::pair<std::string, std::any>> constructor_list;
 typedef std::reference_wrapper<const std::type_info> TypeInfoRef;
 typedef std::vector<std::pair<std::string, TypeInfoRef>> constructor_type_list;
 
-// general encoder and decoder interfaces
+// general encoder and decoder interfaces. `forward_batch` codes the
+// items of a batch in order (and in parallel, unless the codec shares
+// state across the batch).
 class EncoderContextInterface {
  public:
   virtual ~EncoderContextInterface() {}
   virtual std::vector<uint8_t> forward(const nn::Tensor<float, 3> input) = 0;
+  virtual std::vector<std::vector<uint8_t>> forward_batch(
+      const std::vector<nn::Tensor<float, 3>> &inputs) = 0;
   virtual nn::Tensor<float, 3> backward(
       const nn::Tensor<float, 3> gradient_of_output) = 0;
+
+  // makes the next tensor a keyframe, for encoders that code a stream
+  // (see MPEGStreamEncoder). The others code every tensor on its own and
+  // ignore it.
+  virtual void request_keyframe() = 0;
 };
 
 class DecoderContextInterface {
  public:
   virtual ~DecoderContextInterface() {}
   virtual nn::Tensor<float, 3> forward(const std::vector<uint8_t> input) = 0;
+  virtual std::vector<nn::Tensor<float, 3>> forward_batch(
+      const std::vector<std::vector<uint8_t>> &inputs) = 0;
   virtual nn::Tensor<float, 3> backward(
       const nn::Tensor<float, 3> gradient_of_output) = 0;
 };
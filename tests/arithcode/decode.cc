@@ -6,17 +6,9 @@
 
 #include "arithmetic_coder.hh"
 
-int main(int argc, char* argv[]) {
-  if (argc != 3) {
-    std::cout << "usage: " << argv[0] << " <input_file> <output_file>\n";
-    return -1;
-  }
-
-  std::ifstream input_file(argv[1], std::ios::in | std::ios::binary);
-  std::vector<char> compressed_input(std::istreambuf_iterator<char>{input_file},
-                                     {});
-
-  codec::ArithmeticDecoder<codec::SimpleAdaptiveModel> decoder(compressed_input, 64);
+template <class Decoder>
+std::vector<char> decode(const std::vector<char>& compressed_input) {
+  Decoder decoder(compressed_input, 64);
 
   std::string base64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
   std::vector<char> uncompressed_output;
@@ -31,6 +23,27 @@ int main(int argc, char* argv[]) {
     uncompressed_output.push_back(base64[symbol]);
     
   }
+  return uncompressed_output;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3 and argc != 4) {
+    std::cout << "usage: " << argv[0]
+              << " <input_file> <output_file> [simple|power_of_two]\n";
+    return -1;
+  }
+  const std::string model = argc == 4 ? argv[3] : "simple";
+
+  std::ifstream input_file(argv[1], std::ios::in | std::ios::binary);
+  std::vector<char> compressed_input(std::istreambuf_iterator<char>{input_file},
+                                     {});
+
+  const std::vector<char> uncompressed_output =
+      model == "power_of_two"
+          ? decode<codec::FastArithmeticDecoder<
+                codec::PowerOfTwoAdaptiveModel>>(compressed_input)
+          : decode<codec::ArithmeticDecoder<codec::SimpleAdaptiveModel>>(
+                compressed_input);
 
   std::cout << "uncompressed size: " << uncompressed_output.size() << std::endl;
 
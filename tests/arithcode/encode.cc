@@ -6,23 +6,11 @@
 
 #include "arithmetic_coder.hh"
 
-int main(int argc, char* argv[]) {
-  if (argc != 3) {
-    std::cout << "usage: " << argv[0] << " <input_file> <output_file>\n";
-    return -1;
-  }
-
-  std::ifstream t(argv[1]);
-  std::string str((std::istreambuf_iterator<char>(t)),
-                  std::istreambuf_iterator<char>());
-
-  // std::cout << "input text: " << str << std::endl;
-  std::vector<char> uncompressed_input(str.begin(), str.end());
-  std::cout << "input size: " << uncompressed_input.size() << std::endl;
-
+template <class ProbabilityModel>
+std::vector<char> encode(const std::vector<char>& uncompressed_input) {
   std::string base64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
   
-  codec::ArithmeticEncoder<codec::SimpleAdaptiveModel> encoder(64);
+  codec::ArithmeticEncoder<ProbabilityModel> encoder(64);
   for (auto c : uncompressed_input) {
   
     uint32_t sym = 0xDEADBEEF;
@@ -36,7 +24,29 @@ int main(int argc, char* argv[]) {
     assert(sym != 0xDEADBEEF);
     encoder.encode_symbol(sym);
   }
-  const std::vector<char> compressed_output = encoder.finish();
+  return encoder.finish();
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3 and argc != 4) {
+    std::cout << "usage: " << argv[0]
+              << " <input_file> <output_file> [simple|power_of_two]\n";
+    return -1;
+  }
+  const std::string model = argc == 4 ? argv[3] : "simple";
+
+  std::ifstream t(argv[1]);
+  std::string str((std::istreambuf_iterator<char>(t)),
+                  std::istreambuf_iterator<char>());
+
+  // std::cout << "input text: " << str << std::endl;
+  std::vector<char> uncompressed_input(str.begin(), str.end());
+  std::cout << "input size: " << uncompressed_input.size() << std::endl;
+
+  const std::vector<char> compressed_output =
+      model == "power_of_two"
+          ? encode<codec::PowerOfTwoAdaptiveModel>(uncompressed_input)
+          : encode<codec::SimpleAdaptiveModel>(uncompressed_input);
   std::cout << "compressed size (bytes): " << compressed_output.size()
             << std::endl;
 
@@ -0,0 +1,71 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "codec/fastdct.hh"
+#include "tensor.hh"
+
+// Every SIMD kernel must produce exactly what the SSE2 assembly does.
+
+static const std::vector<std::pair<codec::DCTKernel, std::string>> kernels = {
+    {codec::DCTKernel::SSE2, "sse2"},
+    {codec::DCTKernel::AVX2, "avx2"},
+    {codec::DCTKernel::AVX512, "avx512"},
+};
+
+template <class T>
+static bool equal(const nn::Tensor<T, 3> a, const nn::Tensor<T, 3> b) {
+  for (int channel = 0; channel < a.dimension(0); channel++) {
+    for (int row = 0; row < a.dimension(1); row++) {
+      for (int col = 0; col < a.dimension(2); col++) {
+        if (a(channel, row, col) != b(channel, row, col)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  std::srand(0);
+
+  // 7 blocks per row, so every kernel also handles a partial batch
+  nn::Tensor<int16_t, 3> input(5, 24, 56);
+  for (int channel = 0; channel < input.dimension(0); channel++) {
+    for (int row = 0; row < input.dimension(1); row++) {
+      for (int col = 0; col < input.dimension(2); col++) {
+        // the first channel is saturated to test the extremes
+        input(channel, row, col) =
+            channel == 0 ? 255 * (std::rand() % 2) : std::rand() % 256;
+      }
+    }
+  }
+
+  const nn::Tensor<int16_t, 3> reference_dct =
+      codec::FastDCT(codec::DCTKernel::SSE2)(input);
+  const nn::Tensor<uint8_t, 3> reference_idct =
+      codec::FastIDCT(codec::DCTKernel::SSE2)(reference_dct);
+
+  int failures = 0;
+  for (const auto &kernel : kernels) {
+    if (kernel.first > codec::best_dct_kernel()) {
+      std::cout << kernel.second << ": not supported, skipped\n";
+      continue;
+    }
+
+    const nn::Tensor<int16_t, 3> dct = codec::FastDCT(kernel.first)(input);
+    const nn::Tensor<uint8_t, 3> idct =
+        codec::FastIDCT(kernel.first)(reference_dct);
+
+    const bool dct_ok = equal(dct, reference_dct);
+    const bool idct_ok = equal(idct, reference_idct);
+    std::cout << kernel.second << ": dct " << (dct_ok ? "ok" : "MISMATCH")
+              << ", idct " << (idct_ok ? "ok" : "MISMATCH") << "\n";
+
+    failures += !dct_ok + !idct_ok;
+  }
+
+  return failures == 0 ? 0 : 1;
+}